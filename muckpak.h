@@ -6,15 +6,24 @@
 /* Possible defines : */
 /* MUCKPAK_CREATE_ARCHIVE - Can create archives from folders */
 /*                          Optional as it requires several OS specific functions */
+/* MUCKPAK_MMAP           - Can map archives shared between processes, prefetch package */
+/*                          folders in the background and budget resident memory (POSIX only) */
+/* MUCKPAK_DEV_RELOAD     - Can mount a live package over a source folder (Linux only) */
+/*                          Implies MUCKPAK_CREATE_ARCHIVE */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 
 #define MUCKPAK_FOLDER
 
+#if defined(MUCKPAK_DEV_RELOAD) && !defined(MUCKPAK_CREATE_ARCHIVE)
+#define MUCKPAK_CREATE_ARCHIVE
+#endif
+
 #ifdef MUCKPAK_CREATE_ARCHIVE
 #include <dirent.h>
 #include <errno.h>
@@ -34,6 +43,30 @@
 
 #endif
 
+#ifdef MUCKPAK_MMAP
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(RAYLIB_H) && !defined(_MSC_VER)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef MUCKPAK_DEV_RELOAD
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+// Lazily loaded folders and volume reads are thread safe wherever POSIX threads are available
+#ifndef _MSC_VER
+#define M_THREADS
+#include <pthread.h>
+#endif
+
 #define M_FILE_BASE_SIZE (1+sizeof(long)+sizeof(long))
 // File structure for storing file information
 typedef struct m_file {
@@ -45,6 +78,11 @@ typedef struct m_file {
 
 #define M_FOLDER_BASE_SIZE (1+4+4)
 // Folder structure for storing folder information
+// Folders of version 2 archives are loaded on first access, use load_folder() before reading
+// files or subfolders directly (lookups through get_entry_in_folder and get_file do this for you)
+// load_folder and get_file can be called from several threads on one package (except with MSVC)
+// Until then the counts are 0 and files and subfolders are null, so walking an unloaded folder
+// sees it as empty rather than reading past null arrays
 typedef struct m_folder {
     uint8_t name_size;  // Length of name text
     char * name;        // Folder name
@@ -55,6 +93,11 @@ typedef struct m_folder {
 
     m_file * files;
     m_folder * subfolders;
+
+    // Set while the folder's contents are not loaded yet
+    const struct m_view * _toc;             // Table of contents the folder is loaded from
+    const struct m_folder_record * _record; // Folder record to load
+    struct m_folder * _self;                // Where the folder is stored, so copies load it in place
 } m_folder;
 
 // Ambiguous entry type for files and folders
@@ -74,9 +117,12 @@ typedef struct package {
     // Size information
     unsigned long struct_size;  // Size of the package structure
     unsigned long data_size;    // Size of the data in the package
+    unsigned long data_offset;  // Offset of the data in the archive
+    uint32_t version;           // Archive format version (0 is treated as version 1)
 
     m_folder root;              // Root folder
     uint8_t * data;             // Data for all files
+    struct m_view * toc;        // Table of contents that folders are loaded from (version 2 only)
 } package;
 
 // Raw binary archive data (use package to access contents)
@@ -85,12 +131,383 @@ typedef struct archive {
     uint8_t * data;
 } archive;
 
+// - Version 2 archive format -
+// Fixed width, little endian and naturally aligned records that can be queried in place.
+// Version 1 archives start with the structure size where version 2 archives have M_V2_MARKER.
+
+#define M_VERSION_1 1
+#define M_VERSION_2 2
+#define M_VERSION_CURRENT M_VERSION_2
+
+#define M_V2_MARKER 0xFFFFFFFFFFFFFFFFull   // Never a valid version 1 structure size
+#define M_V2_ALIGN 16                       // Alignment of the data section
+
+// Version 2 archive header, the first 64 bytes of the archive
+typedef struct m_archive_header {
+    char id[4];             // Optional Package ID (4 bytes)
+    uint8_t marker[8];      // M_V2_MARKER, in place of the version 1 structure size
+    uint32_t version;       // Format version
+    uint64_t toc_offset;    // Offset of the table of contents in the archive
+    uint64_t toc_size;      // Size of the table of contents
+    uint64_t data_offset;   // Offset of the file data in the archive
+    uint64_t data_size;     // Size of the file data
+    uint32_t folder_count;  // Number of folder records
+    uint32_t file_count;    // Number of file records
+    uint32_t volume_count;  // Number of volumes (0 or 1 for a single file archive)
+    uint32_t volume;        // Index of this volume, only volume 0 has a table of contents
+} m_archive_header;
+
+// Folder record, children of a folder are stored contiguously and sorted by name
+typedef struct m_folder_record {
+    uint32_t name;          // Offset of the name in the string table
+    uint32_t parent;        // Index of the parent folder (M_NO_PARENT for the root)
+    uint32_t first_file;    // Index of the first file record
+    uint32_t file_count;
+    uint32_t first_folder;  // Index of the first subfolder record
+    uint32_t folder_count;
+} m_folder_record;
+
+#define M_NO_PARENT 0xFFFFFFFFu
+
+// File record
+typedef struct m_file_record {
+    uint32_t name;          // Offset of the name in the string table
+    uint32_t volume;        // Volume holding the file data
+    uint64_t size;          // File size
+    uint64_t offset;        // File offset relative to the data section of its volume
+    uint64_t hash;          // FNV-1a hash of the file content
+} m_file_record;
+
+// Table of contents layout: folder records, file records, then the string table.
+// Strings are stored as a length byte, the name and a null terminator.
+
+// Multi-volume archives split the file data across volume files (pack.000.mpak, pack.001.mpak, ...).
+// Volume 0 holds the table of contents, every volume starts with a header naming its index and
+// holds its own data section.
+
+#define M_MAX_VOLUMES 1000
+
+// Read only view over a version 2 archive, used in place without unarchiving
+typedef struct m_view {
+    const m_archive_header * header;
+    const m_folder_record * folders;
+    const m_file_record * files;
+    const uint8_t * strings;
+    const uint8_t * data;       // File data section
+    const uint8_t * const * volumes;    // Data section of each volume (multi-volume archives only)
+    const uint64_t * volume_sizes;      // Data section size of each volume (multi-volume archives only)
+} m_view;
+
+// Convert between little endian archive values and host values
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define m_le32(x) __builtin_bswap32(x)
+#define m_le64(x) __builtin_bswap64(x)
+#else
+#define m_le32(x) (x)
+#define m_le64(x) (x)
+#endif
+
+#define M_HASH_SEED 0xCBF29CE484222325ull
+
+// Continue an FNV-1a hash with another block of data (start from M_HASH_SEED)
+uint64_t m_hash_update(uint64_t hash, const uint8_t * data, uint64_t size) {
+    for(uint64_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// FNV-1a hash of a block of data
+uint64_t m_hash(const uint8_t * data, uint64_t size) {
+    return m_hash_update(M_HASH_SEED, data, size);
+}
+
+// Hash of a payload in a package's data
+typedef struct _m_payload {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t hash;
+} _m_payload;
+
+int _m_compare_payload_offsets(const void * a, const void * b) {
+    const _m_payload * pa = (const _m_payload *)a, * pb = (const _m_payload *)b;
+    if(pa->offset != pb->offset) return pa->offset < pb->offset ? -1 : 1;
+    return (pa->size > pb->size) - (pa->size < pb->size);
+}
+
+// Find a payload in a list sorted by _m_compare_payload_offsets
+const _m_payload * _m_find_payload(const _m_payload * payloads, unsigned long count, uint64_t offset, uint64_t size) {
+    if(!count) return NULL;
+    _m_payload key = { offset, size, 0 };
+    return (const _m_payload *)bsearch(&key, payloads, count, sizeof(_m_payload), _m_compare_payload_offsets);
+}
+
+// Write a fixed width little endian integer to a file
+bool _m_write_u64(FILE * f, uint64_t value) {
+    uint8_t bytes[8];
+    for(int i = 0; i < 8; ++i)
+        bytes[i] = (uint8_t)(value >> (i * 8));
+    return fwrite(bytes, 1, 8, f) == 8;
+}
+
+// Read a fixed width little endian integer from a file
+bool _m_read_u64(FILE * f, uint64_t * value) {
+    uint8_t bytes[8];
+    if(fread(bytes, 1, 8, f) != 8) return false;
+    *value = 0;
+    for(int i = 0; i < 8; ++i)
+        *value |= (uint64_t)bytes[i] << (i * 8);
+    return true;
+}
+
+// Modification time of a file in nanoseconds (whole seconds where the platform has no finer time)
+uint64_t _m_stat_mtime(const struct stat * st) {
+    uint64_t mtime = (uint64_t)st->st_mtime * 1000000000ull;
+    #ifdef __linux__
+    mtime += st->st_mtim.tv_nsec;
+    #endif
+    return mtime;
+}
+
+// Remove a partly written output file, anything that isn't a regular file (like a device) is left alone
+void _m_remove_output(const char * filename) {
+    struct stat st;
+    if(stat(filename, &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG)
+        remove(filename);
+}
+
+// Records of a view are checked when they are used rather than when the view is opened, so opening
+// stays constant time. Malformed records read as missing instead of reading outside the archive.
+
+// Get a name from the string table of a view, null if it doesn't fit in the table
+const uint8_t * _m_view_string(m_view view, uint32_t name) {
+    uint64_t strings_size = m_le64(view.header->toc_size) - (uint64_t)(view.strings - (const uint8_t *)view.folders);
+    uint64_t offset = m_le32(name);
+    if(offset >= strings_size || offset + view.strings[offset] + 2 > strings_size || view.strings[offset + view.strings[offset] + 1] != '\0')
+        return NULL;
+    return view.strings + offset;
+}
+
+// Check a folder record's children are in the view, subfolders come after their parent so walks always end
+bool _m_view_children_valid(m_view view, const m_folder_record * folder) {
+    uint64_t index = folder - view.folders;
+    uint64_t first_folder = m_le32(folder->first_folder), folder_count = m_le32(folder->folder_count);
+    uint64_t first_file = m_le32(folder->first_file), file_count = m_le32(folder->file_count);
+    return (folder_count == 0 || (first_folder > index && first_folder + folder_count <= m_le32(view.header->folder_count)))
+        && first_file + file_count <= m_le32(view.header->file_count);
+}
+
+// Check a file record's payload is in the data section of its volume
+bool _m_view_payload_valid(m_view view, const m_file_record * file) {
+    uint32_t volume = m_le32(file->volume);
+    uint64_t data_size;
+    if(view.volumes) {
+        if(!view.volume_sizes || volume >= m_le32(view.header->volume_count)) return false;
+        data_size = view.volume_sizes[volume];
+    }
+    else {
+        if(volume != 0) return false;
+        data_size = m_le64(view.header->data_size);
+    }
+    uint64_t offset = m_le64(file->offset), size = m_le64(file->size);
+    return offset <= data_size && size <= data_size - offset;
+}
+
+#ifdef M_THREADS
+pthread_mutex_t _m_folder_lock = PTHREAD_MUTEX_INITIALIZER;    // Held while any folder is first loaded
+#endif
+
+// Load a version 2 folder's files and subfolders if that hasn't happened yet
+// Subfolders are only named, each loads its own contents on first access
+m_folder * load_folder(m_folder * folder) {
+    #ifdef M_THREADS
+    // A loaded folder is never written again, so only the first load takes the lock
+    if(!__atomic_load_n(&folder->_record, __ATOMIC_ACQUIRE)) return folder;
+    pthread_mutex_lock(&_m_folder_lock);
+    if(!folder->_record) {
+        // Another thread loaded it first
+        pthread_mutex_unlock(&_m_folder_lock);
+        return folder;
+    }
+    #else
+    if(!folder->_record) return folder;
+    #endif
+    m_view view = *folder->_toc;
+    const m_folder_record * record = folder->_record;
+    const uint8_t * name;
+
+    // Malformed folders are left empty
+    bool valid = _m_view_children_valid(view, record);
+    for(uint32_t i = 0; valid && i < m_le32(record->file_count); ++i) {
+        const m_file_record * file = view.files + m_le32(record->first_file) + i;
+        valid = _m_view_string(view, file->name) && _m_view_payload_valid(view, file);
+    }
+    for(uint32_t i = 0; valid && i < m_le32(record->folder_count); ++i)
+        valid = _m_view_string(view, view.folders[m_le32(record->first_folder) + i].name) != NULL;
+    if(valid) {
+        folder->file_count = m_le32(record->file_count);
+        folder->folder_count = m_le32(record->folder_count);
+    }
+    else fprintf(stderr, "Failed to load folder %s: malformed table of contents\n", folder->name);
+
+    // Read files
+    folder->files = (m_file *)malloc(sizeof(m_file) * folder->file_count);
+    const m_file_record * files = view.files + m_le32(record->first_file);
+    for(unsigned int i = 0; i < folder->file_count; ++i) {
+        m_file * file = &folder->files[i];
+        name = view.strings + m_le32(files[i].name);
+        file->name_size = name[0];
+        file->name = (char *)malloc(file->name_size + 1);
+        memcpy(file->name, name + 1, file->name_size + 1);
+        file->size = m_le64(files[i].size);
+        file->offset = m_le64(files[i].offset);
+
+        // Volumes are loaded one after another into the package data
+        if(view.volumes) file->offset += view.volumes[m_le32(files[i].volume)] - view.data;
+    }
+
+    // Name subfolders, leaving their contents unloaded
+    folder->subfolders = (m_folder *)malloc(sizeof(m_folder) * folder->folder_count);
+    const m_folder_record * subfolders = view.folders + m_le32(record->first_folder);
+    for(unsigned int i = 0; i < folder->folder_count; ++i) {
+        m_folder * subfolder = &folder->subfolders[i];
+        m_folder empty = {};
+        *subfolder = empty;
+        name = view.strings + m_le32(subfolders[i].name);
+        subfolder->name_size = name[0];
+        subfolder->name = (char *)malloc(subfolder->name_size + 1);
+        memcpy(subfolder->name, name + 1, subfolder->name_size + 1);
+        subfolder->_toc = folder->_toc;
+        subfolder->_record = &subfolders[i];
+        subfolder->_self = subfolder;
+    }
+
+    #ifdef M_THREADS
+    __atomic_store_n(&folder->_record, (const m_folder_record *)NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&_m_folder_lock);
+    #else
+    folder->_record = NULL;
+    #endif
+    return folder;
+}
+
+// Get a loaded copy of a folder passed by value
+m_folder _m_folder_value(m_folder folder) {
+    if(folder._record && folder._self) return *load_folder(folder._self);
+    return folder;
+}
+
 // - Package creation functions -
 
 #ifdef MUCKPAK_CREATE_ARCHIVE
 
+// Build cache entry, remembers where an unchanged source file's payload is in the previous archive
+typedef struct m_cache_entry {
+    char * path;        // Path relative to the packed folder
+    uint64_t size;      // Source file size
+    uint64_t mtime;     // Source modification time (nanoseconds where available)
+    uint64_t inode;     // Source inode (0 where unavailable)
+    uint64_t hash;      // FNV-1a hash of the content
+    uint64_t offset;    // Payload offset in the archive (from the start of the archive)
+} m_cache_entry;
+
+#define M_CACHE_CHUNK_SIZE 65536    // Buffer size used when hashing an archive's table of contents
+
+// Build cache for incremental packing, kept next to the archive
+// It is keyed on the archive's size, modification time, inode and the hash of its table of contents,
+// so a rewritten archive isn't trusted even if its size and modification time match
+typedef struct m_build_cache {
+    m_cache_entry * entries;        // Entries of the previous build, sorted by path
+    unsigned long count;
+    FILE * archive;                 // Previous archive, unchanged payloads are copied from it
+
+    m_cache_entry * next;           // Entries of the current build (offsets relative to the data)
+    unsigned long next_count, next_capacity;
+    size_t root_size;               // Length of the packed folder path
+
+    unsigned long reused;           // Payloads copied from the previous archive
+    unsigned long loaded;           // Payloads read from the source folder
+    unsigned long hashed;           // Payloads hashed while loading and archiving, unchanged payloads keep their cached hash
+} m_build_cache;
+
+#define M_CACHE_VERSION 2
+
+// Find the previous build's entry for a path
+m_cache_entry * _m_find_cache_entry(m_build_cache * cache, const char * path) {
+    unsigned long low = 0, high = cache->count;
+    while(low < high) {
+        unsigned long mid = low + (high - low) / 2;
+        int result = strcmp(cache->entries[mid].path, path);
+        if(result == 0) return &cache->entries[mid];
+        if(result < 0) low = mid + 1;
+        else high = mid;
+    }
+    return NULL;
+}
+
+// Load a source file's payload into the package, from the previous archive if it is unchanged
+void _load_file_data(const char * path, m_file * file, unsigned long * offset, package * pkg, m_build_cache * cache) {
+    struct stat st = {};
+    uint64_t mtime = 0;
+    m_cache_entry * cached = NULL;
+    if(cache && stat(path, &st) == 0) {
+        mtime = _m_stat_mtime(&st);
+        if(cache->archive) cached = _m_find_cache_entry(cache, path + cache->root_size);
+        if(cached && (cached->size != (uint64_t)st.st_size || cached->mtime != mtime || cached->inode != (uint64_t)st.st_ino))
+            cached = NULL;
+    }
+
+    file->offset = *offset;
+    bool copied = false;
+    if(cached) {
+        // Copy the payload block wise from the previous archive
+        file->size = cached->size;
+        pkg->data = (uint8_t *)realloc(pkg->data, *offset + file->size);
+        fseek(cache->archive, cached->offset, SEEK_SET);
+        copied = fread(pkg->data + *offset, 1, file->size, cache->archive) == file->size;
+        if(copied) cache->reused++;
+    }
+    if(!copied) {
+        // Load the file data
+        FILE * f = fopen(path, "rb");
+        if(!f) {
+            perror("Failed to open file");
+            file->size = 0;
+            return;
+        }
+        fseek(f, 0L, SEEK_END);
+        file->size = ftell(f);
+        fseek(f, 0L, SEEK_SET);
+
+        // Add file data to the package
+        pkg->data = (uint8_t *)realloc(pkg->data, *offset + file->size);
+        fread(pkg->data + *offset, 1, file->size, f);
+        fclose(f);
+        if(cache) cache->loaded++;
+    }
+
+    // Record the file for the next build
+    if(cache) {
+        if(cache->next_count == cache->next_capacity) {
+            cache->next_capacity = cache->next_capacity ? cache->next_capacity * 2 : 64;
+            cache->next = (m_cache_entry *)realloc(cache->next, sizeof(m_cache_entry) * cache->next_capacity);
+        }
+        m_cache_entry * entry = &cache->next[cache->next_count++];
+        entry->path = strdup(path + cache->root_size);
+        entry->size = file->size;
+        entry->mtime = mtime;
+        entry->inode = st.st_ino;
+        entry->hash = copied ? cached->hash : m_hash(pkg->data + *offset, file->size);
+        if(!copied) cache->hashed++;
+        entry->offset = *offset;
+    }
+
+    *offset += file->size;
+}
+
 // Load a folder structure recursively
-m_folder _load_folder(const char * folder_path, const char * folder_name, unsigned long * offset, package * pkg) {
+m_folder _load_folder(const char * folder_path, const char * folder_name, unsigned long * offset, package * pkg, m_build_cache * cache) {
     m_folder folder = {};
     folder.name_size = strlen(folder_name);
     folder.name = (char *)malloc(folder.name_size + 1);
@@ -143,7 +560,7 @@ m_folder _load_folder(const char * folder_path, const char * folder_name, unsign
         snprintf(path, sizeof(path), "%s/%s", folder_path, entry->d_name);
 
         if(entry->d_type == DT_DIR) {
-            folder.subfolders[folder.folder_count] = _load_folder(path, entry->d_name, offset, pkg);
+            folder.subfolders[folder.folder_count] = _load_folder(path, entry->d_name, offset, pkg, cache);
             folder.folder_count++;
         }
         else if(entry->d_type == DT_REG) {
@@ -153,17 +570,7 @@ m_folder _load_folder(const char * folder_path, const char * folder_name, unsign
             strcpy(file->name, entry->d_name);
 
             // Load the file data
-            FILE * f = fopen(path, "rb");
-            fseek(f, 0L, SEEK_END);
-            file->size = ftell(f);
-            fseek(f, 0L, SEEK_SET);
-
-            // Add file data to the package
-            pkg->data = (uint8_t *)realloc(pkg->data, *offset + file->size);
-            file->offset = *offset;
-            fread(pkg->data + *offset, 1, file->size, f);
-            *offset += file->size;
-            fclose(f);
+            _load_file_data(path, file, offset, pkg, cache);
 
             // Increment package structure size
             pkg->struct_size += M_FILE_BASE_SIZE + file->name_size;
@@ -219,7 +626,7 @@ m_folder _load_folder(const char * folder_path, const char * folder_name, unsign
         snprintf(path, sizeof(path), "%s\\%s", folder_path, find_data.cFileName);
 
         if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            folder.subfolders[folder.folder_count] = _load_folder(path, find_data.cFileName, offset, pkg);
+            folder.subfolders[folder.folder_count] = _load_folder(path, find_data.cFileName, offset, pkg, cache);
             folder.folder_count++;
         } else {
             m_file * file = &folder.files[folder.file_count];
@@ -227,16 +634,7 @@ m_folder _load_folder(const char * folder_path, const char * folder_name, unsign
             file->name = (char *)malloc(file->name_size + 1);
             strcpy(file->name, find_data.cFileName);
 
-            FILE * f = fopen(path, "rb");
-            fseek(f, 0L, SEEK_END);
-            file->size = ftell(f);
-            fseek(f, 0L, SEEK_SET);
-
-            pkg->data = (uint8_t *)realloc(pkg->data, *offset + file->size);
-            file->offset = *offset;
-            fread(pkg->data + *offset, 1, file->size, f);
-            *offset += file->size;
-            fclose(f);
+            _load_file_data(path, file, offset, pkg, cache);
 
             pkg->struct_size += M_FILE_BASE_SIZE + file->name_size;
 
@@ -250,22 +648,34 @@ m_folder _load_folder(const char * folder_path, const char * folder_name, unsign
     return folder;
 }
 
-// Create a package from a local folder
-package load_package_folder(const char * folder) {
+// Create a package from a local folder, unchanged files are copied from the cache's previous archive
+package load_package_folder_cached(const char * folder, m_build_cache * cache) {
     package pkg = {};
     strncpy(pkg.id, "MPAK", 4);     // Set default ID
     pkg.struct_size = M_PACKAGE_HEAD_SIZE;
+    pkg.version = M_VERSION_CURRENT;
+    if(cache) cache->root_size = strlen(folder) + 1;
 
     // Load the folder structure
     unsigned long offset = 0;
-    pkg.root = _load_folder(folder, folder, &offset, &pkg);
+    pkg.root = _load_folder(folder, folder, &offset, &pkg, cache);
     pkg.data_size = offset;
     
     return pkg;
 }
 
+// Create a package from a local folder
+package load_package_folder(const char * folder) {
+    return load_package_folder_cached(folder, NULL);
+}
+
+int _m_compare_cache_paths(const void * a, const void * b) {
+    return strcmp(((const m_cache_entry *)a)->path, ((const m_cache_entry *)b)->path);
+}
+
 // Save a folder structure to a local directory
 void _save_folder(package pkg, m_folder folder, const char * path) {
+    folder = _m_folder_value(folder);
     // Create the folder if it doesn't exist
     char full_path[1024];
     snprintf(full_path, sizeof(full_path), "%s/%s", path, folder.name);
@@ -322,6 +732,7 @@ void save_package_folder(package pkg) {
 
 // Archive a folder structure into a single data binary
 uint8_t * _archive_folder(m_folder folder, uint8_t * data) {
+    folder = _m_folder_value(folder);
     // Archive folder name
     data[0] = folder.name_size;
     memcpy(data + 1, folder.name, folder.name_size);
@@ -350,9 +761,166 @@ uint8_t * _archive_folder(m_folder folder, uint8_t * data) {
     return data; // Return updated data pointer
 }
 
+// Compare two names the way version 2 archives sort them
+int _m_name_compare(const char * a, size_t a_size, const char * b, size_t b_size) {
+    int result = memcmp(a, b, a_size < b_size ? a_size : b_size);
+    if(result) return result;
+    return (a_size > b_size) - (a_size < b_size);
+}
+
+int _m_compare_folder_names(const void * a, const void * b) {
+    const m_folder * fa = *(const m_folder **)a;
+    const m_folder * fb = *(const m_folder **)b;
+    return _m_name_compare(fa->name, fa->name_size, fb->name, fb->name_size);
+}
+
+int _m_compare_file_names(const void * a, const void * b) {
+    const m_file * fa = *(const m_file **)a;
+    const m_file * fb = *(const m_file **)b;
+    return _m_name_compare(fa->name, fa->name_size, fb->name, fb->name_size);
+}
+
+// Add a name to a version 2 string table, returns its offset
+uint32_t _m_write_string(uint8_t * strings, unsigned long * offset, const char * name, uint8_t name_size) {
+    uint32_t start = *offset;
+    strings[start] = name_size;
+    memcpy(strings + start + 1, name, name_size);
+    strings[start + 1 + name_size] = '\0';
+    *offset += name_size + 2;
+    return m_le32(start);
+}
+
+// Archive a package into a single version 2 data binary
+// An index only archive stops after the table of contents and leaves file hashes at 0
+// Payloads found in hashes (sorted by offset) aren't hashed again, the others are counted in hashed (optional)
+archive _archive_package_v2(package pkg, bool index_only, const _m_payload * hashes, unsigned long hash_count, unsigned long * hashed) {
+    // Order folders breadth first so the children of each folder are contiguous
+    unsigned long folder_count = 1, folder_capacity = 16;
+    unsigned long file_count = 0, strings_size = pkg.root.name_size + 2;
+    m_folder ** folders = (m_folder **)malloc(sizeof(m_folder *) * folder_capacity);
+    folders[0] = &pkg.root;
+    for(unsigned long i = 0; i < folder_count; ++i) {
+        m_folder * folder = load_folder(folders[i]);
+        if(folder_count + folder->folder_count > folder_capacity) {
+            while(folder_count + folder->folder_count > folder_capacity) folder_capacity *= 2;
+            folders = (m_folder **)realloc(folders, sizeof(m_folder *) * folder_capacity);
+        }
+        for(unsigned int j = 0; j < folder->folder_count; ++j) {
+            folders[folder_count + j] = &folder->subfolders[j];
+            strings_size += folder->subfolders[j].name_size + 2;
+        }
+        qsort(folders + folder_count, folder->folder_count, sizeof(m_folder *), _m_compare_folder_names);
+        folder_count += folder->folder_count;
+
+        for(unsigned int j = 0; j < folder->file_count; ++j)
+            strings_size += folder->files[j].name_size + 2;
+        file_count += folder->file_count;
+    }
+    strings_size = (strings_size + 7) & ~7ul;
+
+    // Lay out the archive
+    m_archive_header header = {};
+    memcpy(header.id, pkg.id, 4);
+    memset(header.marker, 0xFF, sizeof(header.marker));
+    header.version = M_VERSION_2;
+    header.toc_offset = sizeof(m_archive_header);
+    header.toc_size = sizeof(m_folder_record) * folder_count + sizeof(m_file_record) * file_count + strings_size;
+    header.data_offset = (header.toc_offset + header.toc_size + M_V2_ALIGN - 1) & ~(uint64_t)(M_V2_ALIGN - 1);
+    header.data_size = pkg.data_size;
+    header.folder_count = folder_count;
+    header.file_count = file_count;
+
+    archive arc = {};
+    arc.size = header.data_offset + (index_only ? 0 : header.data_size);
+    arc.data = (uint8_t *)calloc(1, arc.size);
+
+    m_folder_record * folder_records = (m_folder_record *)(arc.data + header.toc_offset);
+    m_file_record * file_records = (m_file_record *)(folder_records + folder_count);
+    uint8_t * strings = (uint8_t *)(file_records + file_count);
+    unsigned long string_offset = 0;
+
+    // Write records
+    folder_records[0].name = _m_write_string(strings, &string_offset, pkg.root.name, pkg.root.name_size);
+    folder_records[0].parent = m_le32(M_NO_PARENT);
+    unsigned long next_folder = 1, next_file = 0;
+    m_file ** files = NULL;
+    unsigned int files_capacity = 0;
+    for(unsigned long i = 0; i < folder_count; ++i) {
+        m_folder * folder = folders[i];
+        m_folder_record * record = &folder_records[i];
+        record->first_folder = m_le32(next_folder);
+        record->folder_count = m_le32(folder->folder_count);
+        record->first_file = m_le32(next_file);
+        record->file_count = m_le32(folder->file_count);
+
+        // Subfolder names, in the sorted order of the breadth first list
+        for(unsigned int j = 0; j < folder->folder_count; ++j) {
+            m_folder_record * child = &folder_records[next_folder + j];
+            m_folder * subfolder = folders[next_folder + j];
+            child->name = _m_write_string(strings, &string_offset, subfolder->name, subfolder->name_size);
+            child->parent = m_le32(i);
+        }
+        next_folder += folder->folder_count;
+
+        // Sorted files
+        if(folder->file_count > files_capacity) {
+            files_capacity = folder->file_count;
+            files = (m_file **)realloc(files, sizeof(m_file *) * files_capacity);
+        }
+        for(unsigned int j = 0; j < folder->file_count; ++j)
+            files[j] = &folder->files[j];
+        qsort(files, folder->file_count, sizeof(m_file *), _m_compare_file_names);
+        for(unsigned int j = 0; j < folder->file_count; ++j) {
+            m_file_record * file = &file_records[next_file + j];
+            file->name = _m_write_string(strings, &string_offset, files[j]->name, files[j]->name_size);
+            file->size = m_le64((uint64_t)files[j]->size);
+            file->offset = m_le64((uint64_t)files[j]->offset);
+            if(!index_only) {
+                const _m_payload * known = _m_find_payload(hashes, hash_count, files[j]->offset, files[j]->size);
+                file->hash = m_le64(known ? known->hash : m_hash(pkg.data + files[j]->offset, files[j]->size));
+                if(!known && hashed) (*hashed)++;
+            }
+        }
+        next_file += folder->file_count;
+    }
+
+    // Convert and write the header
+    header.version = m_le32(header.version);
+    header.toc_offset = m_le64(header.toc_offset);
+    header.toc_size = m_le64(header.toc_size);
+    header.data_offset = m_le64(header.data_offset);
+    header.data_size = m_le64(header.data_size);
+    header.folder_count = m_le32(header.folder_count);
+    header.file_count = m_le32(header.file_count);
+    memcpy(arc.data, &header, sizeof(header));
+
+    // Write file data
+    if(!index_only)
+        memcpy(arc.data + header.data_offset, pkg.data, pkg.data_size);
+
+    free(folders);
+    free(files);
+    return arc;
+}
+
+// Size of a folder in the version 1 structure
+unsigned long _m_v1_folder_size(m_folder folder) {
+    folder = _m_folder_value(folder);
+    unsigned long size = M_FOLDER_BASE_SIZE + folder.name_size;
+    for(unsigned int i = 0; i < folder.file_count; ++i)
+        size += M_FILE_BASE_SIZE + folder.files[i].name_size;
+    for(unsigned int i = 0; i < folder.folder_count; ++i)
+        size += _m_v1_folder_size(folder.subfolders[i]);
+    return size;
+}
+
 // Archive a package into a single data binary
 archive archive_package(package pkg) {
+    if(pkg.version == M_VERSION_2)
+        return _archive_package_v2(pkg, false, NULL, 0, NULL);
+
     archive arc = {};
+    pkg.struct_size = M_PACKAGE_HEAD_SIZE + _m_v1_folder_size(pkg.root);
     arc.size = pkg.struct_size + pkg.data_size;
     arc.data = (uint8_t *)malloc(arc.size);
 
@@ -375,6 +943,194 @@ archive archive_package(package pkg) {
     return arc;
 }
 
+// Get the format version of archive data (0 if it is not an archive)
+uint32_t archive_version(const uint8_t * data, unsigned long size) {
+    if(size >= sizeof(m_archive_header)) {
+        const m_archive_header * header = (const m_archive_header *)data;
+        bool marked = true;
+        for(unsigned int i = 0; i < sizeof(header->marker); ++i)
+            marked &= header->marker[i] == 0xFF;
+        if(marked) return m_le32(header->version);
+    }
+    return size >= M_PACKAGE_HEAD_SIZE ? M_VERSION_1 : 0;
+}
+
+// Open a view over the header and table of contents of version 2 archive data, without checking the file data
+bool _m_open_view_toc(const uint8_t * data, unsigned long size, m_view * view) {
+    if(archive_version(data, size) != M_VERSION_2) return false;
+    const m_archive_header * header = (const m_archive_header *)data;
+    uint64_t toc_offset = m_le64(header->toc_offset);
+    uint64_t toc_size = m_le64(header->toc_size);
+    uint64_t records_size = sizeof(m_folder_record) * (uint64_t)m_le32(header->folder_count)
+        + sizeof(m_file_record) * (uint64_t)m_le32(header->file_count);
+
+    // Check the table of contents fits in the archive, only the first volume has one
+    if(toc_offset % 8 || toc_offset < sizeof(m_archive_header) || toc_offset > size || toc_size > size - toc_offset
+        || records_size > toc_size || m_le32(header->folder_count) == 0 || m_le32(header->volume) != 0
+        || m_le32(header->volume_count) > M_MAX_VOLUMES)
+        return false;
+
+    view->header = header;
+    view->folders = (const m_folder_record *)(data + toc_offset);
+    view->files = (const m_file_record *)(view->folders + m_le32(header->folder_count));
+    view->strings = (const uint8_t *)(view->files + m_le32(header->file_count));
+    view->data = NULL;
+    view->volumes = NULL;
+    view->volume_sizes = NULL;
+    return true;
+}
+
+// Open a view over version 2 archive data, returns false if the data isn't a valid version 2 archive
+// Runs in constant time and does not allocate, the data must outlive the view
+// For multi-volume archives this is the first volume, set view.volumes to the data of every volume
+// (from volume_data) and view.volume_sizes to their data_size before reading files
+// Records are checked as they are used, lookups skip malformed records
+bool open_view(const uint8_t * data, unsigned long size, m_view * view) {
+    if(!_m_open_view_toc(data, size, view)) return false;
+    uint64_t data_offset = m_le64(view->header->data_offset);
+    uint64_t data_size = m_le64(view->header->data_size);
+
+    // Check the file data fits in the archive
+    if(data_offset > size || data_size > size - data_offset)
+        return false;
+
+    view->data = data + data_offset;
+    return true;
+}
+
+// Get the data section of a volume of a view's archive, null if the data isn't that volume
+// Volumes record the size of the table of contents they were written with, so mismatched sets are caught
+const uint8_t * volume_data(m_view view, const uint8_t * data, unsigned long size, uint32_t volume) {
+    if(archive_version(data, size) != M_VERSION_2) return NULL;
+    const m_archive_header * header = (const m_archive_header *)data;
+    const m_archive_header * first = view.header;
+    uint64_t data_offset = m_le64(header->data_offset);
+    uint64_t data_size = m_le64(header->data_size);
+    if(m_le32(header->volume) != volume || header->volume_count != first->volume_count || memcmp(header->id, first->id, 4) != 0
+        || header->toc_size != first->toc_size || header->folder_count != first->folder_count || header->file_count != first->file_count
+        || data_offset > size || data_size > size - data_offset)
+        return NULL;
+    return data + data_offset;
+}
+
+// Get the filename of a volume, the volume number goes before the extension (pack.mpak to pack.001.mpak)
+// replacing the number of another volume (pack.000.mpak to pack.001.mpak)
+void archive_volume_filename(char * out, size_t size, const char * filename, uint32_t volume) {
+    const char * name = strrchr(filename, '/');
+    name = name ? name + 1 : filename;
+    const char * extension = strrchr(name, '.');
+    if(!extension || extension == name) extension = name + strlen(name);
+
+    const char * stem_end = extension;
+    if(stem_end - name > 4 && stem_end[-4] == '.' && stem_end[-3] >= '0' && stem_end[-3] <= '9'
+        && stem_end[-2] >= '0' && stem_end[-2] <= '9' && stem_end[-1] >= '0' && stem_end[-1] <= '9')
+        stem_end -= 4;
+    snprintf(out, size, "%.*s.%03u%s", (int)(stem_end - filename), filename, volume, extension);
+}
+
+// Get the root folder of a view
+const m_folder_record * view_root(m_view view) {
+    return view.folders;
+}
+
+// Get a folder's name (null if the record is malformed)
+const char * view_folder_name(m_view view, const m_folder_record * folder) {
+    const uint8_t * name = _m_view_string(view, folder->name);
+    return name ? (const char *)name + 1 : NULL;
+}
+
+// Get a file's name (null if the record is malformed)
+const char * view_file_name(m_view view, const m_file_record * file) {
+    const uint8_t * name = _m_view_string(view, file->name);
+    return name ? (const char *)name + 1 : NULL;
+}
+
+// Compare a record name with a key, malformed names sort after every key
+int _m_view_compare(m_view view, uint32_t name, const char * key, size_t key_size) {
+    const uint8_t * string = _m_view_string(view, name);
+    if(!string) return 1;
+    return _m_name_compare((const char *)string + 1, string[0], key, key_size);
+}
+
+// Get a subfolder in a folder by name (null if not found)
+const m_folder_record * view_find_folder(m_view view, const m_folder_record * folder, const char * name, size_t name_size) {
+    if(!_m_view_children_valid(view, folder)) return NULL;
+    const m_folder_record * children = view.folders + m_le32(folder->first_folder);
+    uint32_t low = 0, high = m_le32(folder->folder_count);
+    while(low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int result = _m_view_compare(view, children[mid].name, name, name_size);
+        if(result == 0) return &children[mid];
+        if(result < 0) low = mid + 1;
+        else high = mid;
+    }
+    return NULL;
+}
+
+// Get a file in a folder by name (null if not found)
+const m_file_record * view_find_file(m_view view, const m_folder_record * folder, const char * name, size_t name_size) {
+    if(!_m_view_children_valid(view, folder)) return NULL;
+    const m_file_record * children = view.files + m_le32(folder->first_file);
+    uint32_t low = 0, high = m_le32(folder->file_count);
+    while(low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int result = _m_view_compare(view, children[mid].name, name, name_size);
+        if(result == 0) return &children[mid];
+        if(result < 0) low = mid + 1;
+        else high = mid;
+    }
+    return NULL;
+}
+
+// Get a folder by path (null if not found)
+const m_folder_record * view_get_folder(m_view view, const char * path) {
+    const m_folder_record * folder = view_root(view);
+    while(folder && *path) {
+        const char * end = strchr(path, '/');
+        size_t size = end ? (size_t)(end - path) : strlen(path);
+        if(size) folder = view_find_folder(view, folder, path, size);
+        path += size + (end ? 1 : 0);
+    }
+    return folder;
+}
+
+// Get a file by path (null if not found)
+const m_file_record * view_get_file(m_view view, const char * path) {
+    // Split off the file name
+    const char * name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    // Find the containing folder
+    const m_folder_record * folder = view_root(view);
+    while(folder && path < name) {
+        const char * end = strchr(path, '/');
+        size_t size = end - path;
+        if(size) folder = view_find_folder(view, folder, path, size);
+        path = end + 1;
+    }
+
+    if(!folder) return NULL;
+    return view_find_file(view, folder, name, strlen(name));
+}
+
+// Get a file's binary data (null if the record's payload is outside the archive)
+const uint8_t * view_file_binary(m_view view, const m_file_record * file) {
+    if(!_m_view_payload_valid(view, file)) return NULL;
+    if(view.volumes) return view.volumes[m_le32(file->volume)] + m_le64(file->offset);
+    return view.data + m_le64(file->offset);
+}
+
+// Get the number of volumes of an archive (1 for a single file archive)
+uint32_t view_volume_count(m_view view) {
+    uint32_t count = m_le32(view.header->volume_count);
+    return count ? count : 1;
+}
+
+// Get a file's size
+uint64_t view_file_size(const m_file_record * file) {
+    return m_le64(file->size);
+}
+
 // Unarchive a folder from an archive data
 m_folder _unarchive_folder(uint8_t ** data) {
     m_folder folder = {};
@@ -418,12 +1174,116 @@ m_folder _unarchive_folder(uint8_t ** data) {
     return folder;
 }
 
+// Unarchive a version 2 package from the archives of its volumes, in volume order
+// Single file archives are their only volume, the data of every volume is loaded into the package data
+package unarchive_volumes(archive * volumes, uint32_t volume_count) {
+    package pkg = {};
+    m_view view;
+    if(volume_count == 0 || !open_view(volumes[0].data, volumes[0].size, &view)) {
+        fprintf(stderr, "Failed to unarchive volumes: not a version 2 archive\n");
+        return pkg;
+    }
+    if(view_volume_count(view) != volume_count) {
+        fprintf(stderr, "Failed to unarchive volumes: archive has %u volumes, %u given\n", view_volume_count(view), volume_count);
+        return pkg;
+    }
+
+    // Find the data of each volume
+    const uint8_t ** data = (const uint8_t **)malloc(sizeof(const uint8_t *) * volume_count);
+    uint64_t * sizes = (uint64_t *)malloc(sizeof(uint64_t) * volume_count);
+    pkg.data_size = 0;
+    for(uint32_t i = 0; i < volume_count; ++i) {
+        data[i] = volume_data(view, volumes[i].data, volumes[i].size, i);
+        if(!data[i]) {
+            fprintf(stderr, "Failed to unarchive volumes: volume %u doesn't belong to the archive\n", i);
+            free(data);
+            free(sizes);
+            return pkg;
+        }
+        sizes[i] = m_le64(((const m_archive_header *)volumes[i].data)->data_size);
+        pkg.data_size += sizes[i];
+    }
+
+    memcpy(pkg.id, volumes[0].data, 4);
+    pkg.version = M_VERSION_2;
+    pkg.data_offset = m_le64(view.header->data_offset);
+    pkg.struct_size = pkg.data_offset;
+    pkg.data = (uint8_t *)malloc(pkg.data_size ? pkg.data_size : 1);
+
+    // Keep a copy of the header and table of contents, folders are loaded from it when first used
+    // Multi-volume archives also keep where each volume's data starts in the package data and its size
+    unsigned long volume_table = volume_count > 1 ? (sizeof(const uint8_t *) + sizeof(uint64_t)) * volume_count : 0;
+    unsigned long toc_size = m_le64(view.header->toc_size);
+    unsigned long toc_end = sizeof(m_archive_header) + toc_size;
+    pkg.toc = (m_view *)malloc(sizeof(m_view) + volume_table + toc_end);
+    uint64_t * volume_sizes = (uint64_t *)(pkg.toc + 1);
+    const uint8_t ** volume_starts = (const uint8_t **)(volume_sizes + (volume_table ? volume_count : 0));
+    uint8_t * toc = (uint8_t *)(pkg.toc + 1) + volume_table;
+    memcpy(toc, view.header, sizeof(m_archive_header));
+    memcpy(toc + sizeof(m_archive_header), view.folders, toc_size);
+    ((m_archive_header *)toc)->toc_offset = m_le64((uint64_t)sizeof(m_archive_header));
+    _m_open_view_toc(toc, toc_end, pkg.toc);
+    pkg.toc->data = pkg.data;
+
+    uint64_t offset = 0;
+    for(uint32_t i = 0; i < volume_count; ++i) {
+        memcpy(pkg.data + offset, data[i], sizes[i]);
+        if(volume_table) {
+            volume_starts[i] = pkg.data + offset;
+            volume_sizes[i] = sizes[i];
+        }
+        offset += sizes[i];
+    }
+    if(volume_table) {
+        pkg.toc->volumes = volume_starts;
+        pkg.toc->volume_sizes = volume_sizes;
+    }
+    free(data);
+    free(sizes);
+
+    // Load the root, its subfolders stay unloaded
+    const m_folder_record * root = view_root(*pkg.toc);
+    const uint8_t * name = _m_view_string(*pkg.toc, root->name);
+    if(!name) {
+        fprintf(stderr, "Failed to unarchive volumes: malformed table of contents\n");
+        free(pkg.data);
+        free(pkg.toc);
+        package empty = {};
+        return empty;
+    }
+    pkg.root.name_size = name[0];
+    pkg.root.name = (char *)malloc(pkg.root.name_size + 1);
+    memcpy(pkg.root.name, name + 1, pkg.root.name_size + 1);
+    pkg.root._toc = pkg.toc;
+    pkg.root._record = root;
+    load_folder(&pkg.root);
+    return pkg;
+}
+
 // Unarchive a package from an archive
 package unarchive_package(archive arc) {
     package pkg = {};
     memcpy(pkg.id, arc.data, 4);
+
+    // Version 2 archives are read through a view
+    m_view view;
+    if(open_view(arc.data, arc.size, &view))
+        return unarchive_volumes(&arc, 1);
+    if(archive_version(arc.data, arc.size) != M_VERSION_1) {
+        fprintf(stderr, "Failed to unarchive package: invalid or unsupported archive\n");
+        package empty = {};
+        return empty;
+    }
+
+    pkg.version = M_VERSION_1;
     pkg.struct_size = *(unsigned long *)(arc.data + 4);
     pkg.data_size = *(unsigned long *)(arc.data + 12);
+    pkg.data_offset = pkg.struct_size;
+    if(pkg.struct_size < M_PACKAGE_HEAD_SIZE || pkg.struct_size > arc.size || pkg.data_size > arc.size - pkg.struct_size) {
+        fprintf(stderr, "Failed to unarchive package: invalid version 1 archive\n");
+        package empty = {};
+        return empty;
+    }
     
     // Allocate memory for data
     pkg.data = (uint8_t *)malloc(pkg.data_size);
@@ -454,6 +1314,96 @@ void save_package_to_archive(const char * filename, package pkg) {
     free(arc.data); // Free the archive data after saving
 }
 
+int _m_compare_record_offsets(const void * a, const void * b) {
+    uint64_t offset_a = m_le64((*(const m_file_record **)a)->offset), offset_b = m_le64((*(const m_file_record **)b)->offset);
+    return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+// Save a package as a multi-volume archive, splitting the file data into volumes of at most volume_size
+// bytes (a larger file gets a volume of its own). filename names the volumes, pack.mpak is saved as
+// pack.000.mpak, pack.001.mpak, ... Returns the number of volumes saved, 0 if saving failed
+uint32_t save_package_volumes(const char * filename, package pkg, unsigned long volume_size) {
+    archive toc = _archive_package_v2(pkg, true, NULL, 0, NULL);
+    m_archive_header * header = (m_archive_header *)toc.data;
+    uint32_t file_count = m_le32(header->file_count);
+    m_folder_record * folders = (m_folder_record *)(toc.data + m_le64(header->toc_offset));
+    m_file_record * records = (m_file_record *)(folders + m_le32(header->folder_count));
+
+    // Assign files to volumes in data order, so each volume is written as one sequential stream
+    m_file_record ** order = (m_file_record **)malloc(sizeof(m_file_record *) * (file_count ? file_count : 1));
+    uint64_t * sources = (uint64_t *)malloc(sizeof(uint64_t) * (file_count ? file_count : 1));
+    for(uint32_t i = 0; i < file_count; ++i)
+        order[i] = &records[i];
+    qsort(order, file_count, sizeof(m_file_record *), _m_compare_record_offsets);
+
+    uint32_t volume_count = 1, volume_capacity = 16;
+    uint64_t * volume_sizes = (uint64_t *)calloc(volume_capacity, sizeof(uint64_t));
+    for(uint32_t i = 0; i < file_count; ++i) {
+        m_file_record * record = order[i];
+        uint64_t size = m_le64(record->size);
+        sources[i] = m_le64(record->offset);
+        if(volume_sizes[volume_count - 1] && volume_sizes[volume_count - 1] + size > volume_size) {
+            if(volume_count == volume_capacity) {
+                volume_capacity *= 2;
+                volume_sizes = (uint64_t *)realloc(volume_sizes, sizeof(uint64_t) * volume_capacity);
+            }
+            volume_sizes[volume_count++] = 0;
+        }
+        record->volume = m_le32(volume_count - 1);
+        record->offset = m_le64(volume_sizes[volume_count - 1]);
+        record->hash = m_le64(m_hash(pkg.data + sources[i], size));
+        volume_sizes[volume_count - 1] += size;
+    }
+
+    // Write each volume, the first holds the table of contents
+    uint32_t saved = 0;
+    if(volume_count <= M_MAX_VOLUMES) {
+        header->volume_count = m_le32(volume_count);
+        m_archive_header volume_header = *header;
+        volume_header.toc_offset = 0;
+        volume_header.data_offset = m_le64((uint64_t)sizeof(m_archive_header));
+
+        uint32_t next = 0;
+        for(uint32_t volume = 0; volume < volume_count; ++volume) {
+            char volume_filename[1024];
+            archive_volume_filename(volume_filename, sizeof(volume_filename), filename, volume);
+            FILE * f = fopen(volume_filename, "wb");
+            if(!f) {
+                perror("Failed to save volume");
+                break;
+            }
+
+            bool success;
+            if(volume == 0) {
+                header->data_size = m_le64(volume_sizes[0]);
+                success = fwrite(toc.data, 1, toc.size, f) == toc.size;
+            }
+            else {
+                volume_header.volume = m_le32(volume);
+                volume_header.data_size = m_le64(volume_sizes[volume]);
+                success = fwrite(&volume_header, sizeof(volume_header), 1, f) == 1;
+            }
+            for(; next < file_count && m_le32(order[next]->volume) == volume; ++next) {
+                uint64_t size = m_le64(order[next]->size);
+                success &= fwrite(pkg.data + sources[next], 1, size, f) == size;
+            }
+            success &= fclose(f) == 0;
+            if(!success) {
+                fprintf(stderr, "Failed to save volume: %s\n", volume_filename);
+                break;
+            }
+            saved++;
+        }
+    }
+    else fprintf(stderr, "Failed to save volumes: more than %d volumes needed\n", M_MAX_VOLUMES);
+
+    free(volume_sizes);
+    free(sources);
+    free(order);
+    free(toc.data);
+    return saved == volume_count ? saved : 0;
+}
+
 // Load an archive from a file
 archive load_archive(const char * filename) {
     archive arc = {};
@@ -471,12 +1421,81 @@ archive load_archive(const char * filename) {
     return arc;
 }
 
+typedef struct _m_volume_load {
+    char filename[1024];
+    archive arc;
+} _m_volume_load;
+
+void * _m_load_volume(void * argument) {
+    _m_volume_load * load = (_m_volume_load *)argument;
+    load->arc = load_archive(load->filename);
+    return NULL;
+}
+
+// Load the volumes of a multi-volume archive after the first, each on its own thread when threads are available
+bool _m_load_volumes(const char * filename, archive * volumes, uint32_t volume_count) {
+    _m_volume_load * loads = (_m_volume_load *)calloc(volume_count, sizeof(_m_volume_load));
+    for(uint32_t i = 1; i < volume_count; ++i)
+        archive_volume_filename(loads[i].filename, sizeof(loads[i].filename), filename, i);
+
+    #ifdef M_THREADS
+    pthread_t * threads = (pthread_t *)malloc(sizeof(pthread_t) * volume_count);
+    bool * started = (bool *)calloc(volume_count, sizeof(bool));
+    for(uint32_t i = 1; i < volume_count; ++i)
+        started[i] = pthread_create(&threads[i], NULL, _m_load_volume, &loads[i]) == 0;
+    for(uint32_t i = 1; i < volume_count; ++i) {
+        if(started[i]) pthread_join(threads[i], NULL);
+        else _m_load_volume(&loads[i]);
+    }
+    free(threads);
+    free(started);
+    #else
+    for(uint32_t i = 1; i < volume_count; ++i)
+        _m_load_volume(&loads[i]);
+    #endif
+
+    bool success = true;
+    for(uint32_t i = 1; i < volume_count; ++i) {
+        volumes[i] = loads[i].arc;
+        success &= volumes[i].data != NULL;
+    }
+    free(loads);
+    return success;
+}
+
 // Load a package from an archive file
+// For multi-volume archives this is the first volume, the rest are loaded alongside it
 package load_package(const char * filename) {
     archive arc = load_archive(filename);
     if(arc.data) {
-        package pkg = unarchive_package(arc);
-        free(arc.data); // Free the archive data after unarchiving
+        // Only the first volume has a table of contents
+        const m_archive_header * header = (const m_archive_header *)arc.data;
+        if(archive_version(arc.data, arc.size) == M_VERSION_2 && m_le32(header->volume) != 0) {
+            char first[1024];
+            archive_volume_filename(first, sizeof(first), filename, 0);
+            fprintf(stderr, "Failed to load package: %s is volume %u of a multi-volume archive, load %s instead\n",
+                filename, m_le32(header->volume), first);
+            free(arc.data);
+            package empty_pkg = {};
+            return empty_pkg;
+        }
+
+        m_view view;
+        uint32_t volume_count = open_view(arc.data, arc.size, &view) ? view_volume_count(view) : 1;
+        if(volume_count == 1) {
+            package pkg = unarchive_package(arc);
+            free(arc.data); // Free the archive data after unarchiving
+            return pkg;
+        }
+
+        archive * volumes = (archive *)calloc(volume_count, sizeof(archive));
+        volumes[0] = arc;
+        package pkg = {};
+        if(_m_load_volumes(filename, volumes, volume_count))
+            pkg = unarchive_volumes(volumes, volume_count);
+        for(uint32_t i = 0; i < volume_count; ++i)
+            free(volumes[i].data);
+        free(volumes);
         return pkg;
     } else {
         package empty_pkg = {};
@@ -484,14 +1503,168 @@ package load_package(const char * filename) {
     }
 }
 
-// - Package reading functions - 
+#ifdef MUCKPAK_CREATE_ARCHIVE
 
-// Get a file/folder entry in a specific folder
-m_entry get_entry_in_folder(m_folder folder, const char * name) {
-    m_entry entry = {};
-    entry.exists = true;
-    
-    // Check files
+// Find where an archive's data starts and hash everything before it (header and table of contents,
+// which holds the hash of every payload for version 2 archives)
+bool _m_archive_identity(FILE * arc, uint64_t * data_offset, uint64_t * hash) {
+    uint8_t buffer[M_CACHE_CHUNK_SIZE];
+    unsigned long head_size = fread(buffer, 1, sizeof(m_archive_header), arc);
+    if(archive_version(buffer, head_size) == M_VERSION_2)
+        *data_offset = m_le64(((m_archive_header *)buffer)->data_offset);
+    else if(head_size >= M_PACKAGE_HEAD_SIZE)
+        memcpy(data_offset, buffer + 4, 8);
+    else
+        return false;
+
+    *hash = M_HASH_SEED;
+    fseek(arc, 0L, SEEK_SET);
+    for(uint64_t left = *data_offset; left > 0;) {
+        size_t chunk = left < sizeof(buffer) ? (size_t)left : sizeof(buffer);
+        if(fread(buffer, 1, chunk, arc) != chunk) return false;
+        *hash = m_hash_update(*hash, buffer, chunk);
+        left -= chunk;
+    }
+    return true;
+}
+
+// Load the build cache of an archive, entries are only used if the archive is the one the cache was saved with
+m_build_cache load_build_cache(const char * cache_filename, const char * archive_filename) {
+    m_build_cache cache = {};
+    FILE * f = fopen(cache_filename, "rb");
+    struct stat st;
+    if(!f || stat(archive_filename, &st) != 0) {
+        if(f) fclose(f);
+        return cache;
+    }
+
+    // Check the cache header matches the archive
+    char id[4];
+    uint64_t version, archive_size, archive_mtime, archive_inode, archive_hash, count;
+    if(fread(id, 1, 4, f) != 4 || memcmp(id, "MPKC", 4) != 0 || !_m_read_u64(f, &version) || version != M_CACHE_VERSION
+        || !_m_read_u64(f, &archive_size) || !_m_read_u64(f, &archive_mtime) || !_m_read_u64(f, &archive_inode)
+        || !_m_read_u64(f, &archive_hash) || !_m_read_u64(f, &count)
+        || archive_size != (uint64_t)st.st_size || archive_mtime != _m_stat_mtime(&st) || archive_inode != (uint64_t)st.st_ino) {
+        fclose(f);
+        return cache;
+    }
+    FILE * arc = fopen(archive_filename, "rb");
+    uint64_t data_offset, hash;
+    if(!arc || !_m_archive_identity(arc, &data_offset, &hash) || hash != archive_hash) {
+        if(arc) fclose(arc);
+        fclose(f);
+        return cache;
+    }
+
+    // Read entries
+    cache.entries = (m_cache_entry *)malloc(sizeof(m_cache_entry) * count);
+    for(cache.count = 0; cache.count < count; ++cache.count) {
+        m_cache_entry * entry = &cache.entries[cache.count];
+        uint64_t path_size;
+        if(!_m_read_u64(f, &path_size) || path_size > 4096) break;
+        entry->path = (char *)malloc(path_size + 1);
+        entry->path[path_size] = '\0';
+        if(fread(entry->path, 1, path_size, f) != path_size || !_m_read_u64(f, &entry->size) || !_m_read_u64(f, &entry->mtime)
+            || !_m_read_u64(f, &entry->inode) || !_m_read_u64(f, &entry->hash) || !_m_read_u64(f, &entry->offset)) {
+            free(entry->path);
+            break;
+        }
+    }
+    fclose(f);
+
+    if(cache.count == count) cache.archive = arc;
+    else fclose(arc);
+    return cache;
+}
+
+// Save the build cache for an archive just written from a package loaded with the cache
+void save_build_cache(const char * cache_filename, const char * archive_filename, m_build_cache * cache) {
+    // Find where the archive's data starts
+    struct stat st;
+    uint64_t data_offset, archive_hash;
+    FILE * arc = fopen(archive_filename, "rb");
+    if(!arc || stat(archive_filename, &st) != 0 || !_m_archive_identity(arc, &data_offset, &archive_hash)) {
+        if(arc) fclose(arc);
+        return;
+    }
+    fclose(arc);
+
+    FILE * f = fopen(cache_filename, "wb");
+    if(!f) {
+        perror("Failed to save build cache");
+        return;
+    }
+    fwrite("MPKC", 1, 4, f);
+    _m_write_u64(f, M_CACHE_VERSION);
+    _m_write_u64(f, st.st_size);
+    _m_write_u64(f, _m_stat_mtime(&st));
+    _m_write_u64(f, st.st_ino);
+    _m_write_u64(f, archive_hash);
+    _m_write_u64(f, cache->next_count);
+
+    // Entries are sorted for lookups in the next build
+    qsort(cache->next, cache->next_count, sizeof(m_cache_entry), _m_compare_cache_paths);
+    for(unsigned long i = 0; i < cache->next_count; ++i) {
+        m_cache_entry * entry = &cache->next[i];
+        size_t path_size = strlen(entry->path);
+        _m_write_u64(f, path_size);
+        fwrite(entry->path, 1, path_size, f);
+        _m_write_u64(f, entry->size);
+        _m_write_u64(f, entry->mtime);
+        _m_write_u64(f, entry->inode);
+        _m_write_u64(f, entry->hash);
+        _m_write_u64(f, data_offset + entry->offset);
+    }
+    fclose(f);
+}
+
+// Archive a package loaded with a build cache, payloads the cache knows aren't hashed again
+// The package must not be changed between loading and archiving it
+archive archive_package_cached(package pkg, m_build_cache * cache) {
+    if(pkg.version != M_VERSION_2 || !cache || !cache->next_count)
+        return archive_package(pkg);
+
+    _m_payload * hashes = (_m_payload *)malloc(sizeof(_m_payload) * cache->next_count);
+    for(unsigned long i = 0; i < cache->next_count; ++i) {
+        hashes[i].offset = cache->next[i].offset;
+        hashes[i].size = cache->next[i].size;
+        hashes[i].hash = cache->next[i].hash;
+    }
+    qsort(hashes, cache->next_count, sizeof(_m_payload), _m_compare_payload_offsets);
+    archive arc = _archive_package_v2(pkg, false, hashes, cache->next_count, &cache->hashed);
+    free(hashes);
+    return arc;
+}
+
+// Save a package loaded with a build cache to an archive file
+void save_package_to_archive_cached(const char * filename, package pkg, m_build_cache * cache) {
+    archive arc = archive_package_cached(pkg, cache);
+    save_archive(filename, arc);
+    free(arc.data);
+}
+
+// Free a build cache
+void free_build_cache(m_build_cache cache) {
+    for(unsigned long i = 0; i < cache.count; ++i)
+        free(cache.entries[i].path);
+    for(unsigned long i = 0; i < cache.next_count; ++i)
+        free(cache.next[i].path);
+    free(cache.entries);
+    free(cache.next);
+    if(cache.archive) fclose(cache.archive);
+}
+
+#endif
+
+// - Package reading functions - 
+
+// Get a file/folder entry in a specific folder
+m_entry get_entry_in_folder(m_folder folder, const char * name) {
+    folder = _m_folder_value(folder);
+    m_entry entry = {};
+    entry.exists = true;
+    
+    // Check files
     for(unsigned int i = 0; i < folder.file_count; ++i) {
         if(strcmp(folder.files[i].name, name) == 0) {
             entry.is_file = true;
@@ -504,7 +1677,7 @@ m_entry get_entry_in_folder(m_folder folder, const char * name) {
     for(unsigned int i = 0; i < folder.folder_count; ++i) {
         if(strcmp(folder.subfolders[i].name, name) == 0) {
             entry.is_file = false;
-            entry.folder = &folder.subfolders[i];
+            entry.folder = load_folder(&folder.subfolders[i]);
             return entry;
         }
     }
@@ -557,6 +1730,12 @@ char * read_file_text(m_file file, package pkg) {
 }
 
 void _free_folder(m_folder folder) {
+    // Unloaded folders only have a name
+    if(folder._record) {
+        free(folder.name);
+        return;
+    }
+
     // Free files
     for(unsigned int i = 0; i < folder.file_count; ++i)
         free(folder.files[i].name);
@@ -576,10 +1755,12 @@ void _free_folder(m_folder folder) {
 void free_package(package pkg) {
     _free_folder(pkg.root);
     free(pkg.data);
+    free(pkg.toc);
 }
 
 // Dump a directory structure to stdout
 void dump_directory(m_folder folder, const char * prefix) {
+    folder = _m_folder_value(folder);
     printf("%s%s/\n", prefix, folder.name);
 
     // Create padding for sub folders/files
@@ -599,59 +1780,2870 @@ void dump_directory(m_folder folder, const char * prefix) {
     free(padding);
 }
 
-// - Raylib integration functions -
-#ifdef RAYLIB_H
+// - Package query functions -
 
-// Load an image from a file in the package
-Image m_load_image(package pkg, m_file file) {
-    // Get file extension 
-    const char * ext = strrchr(file.name, '.');
-    if(ext == NULL) {
-        TraceLog(LOG_WARNING, "File has no extension: %s", file.name);
-        return {};
+#define M_QUERY_PATH_SIZE 256   // Starting size of the query path, it grows to fit longer paths
+#define M_QUERY_MAX_DEPTH 64    // Most segments in a query pattern
+
+// Query callbacks get the file's path relative to the root, return false to stop the query
+typedef bool (*m_query_callback)(const char * path, m_file * file, void * user);
+typedef bool (*m_view_query_callback)(const char * path, const m_file_record * file, void * user);
+
+// Pattern segment
+typedef struct _m_segment {
+    const char * text;
+    size_t size;
+} _m_segment;
+
+// Query state shared by the recursive walk
+typedef struct _m_query {
+    _m_segment segments[M_QUERY_MAX_DEPTH];
+    unsigned int segment_count;
+    char * path;                // Path of the current entry
+    size_t path_size;
+    m_view view;
+    m_query_callback callback;  // Set when querying a package, folders are walked alongside the view when it has one
+    m_view_query_callback view_callback;
+    void * user;
+} _m_query;
+
+// Start a query (free it with _m_free_query)
+_m_query * _m_new_query(m_query_callback callback, m_view_query_callback view_callback, void * user) {
+    _m_query * query = (_m_query *)malloc(sizeof(_m_query));
+    query->path = (char *)malloc(M_QUERY_PATH_SIZE);
+    query->path_size = M_QUERY_PATH_SIZE;
+    query->path[0] = '\0';
+    query->callback = callback;
+    query->view_callback = view_callback;
+    query->user = user;
+    return query;
+}
+
+void _m_free_query(_m_query * query) {
+    free(query->path);
+    free(query);
+}
+
+// Match a name against a single glob segment (supports *, ? and [...] classes)
+bool m_glob_match(const char * pattern, size_t pattern_size, const char * name, size_t name_size) {
+    size_t p = 0, n = 0;
+    size_t star = (size_t)-1, star_n = 0;   // Last star, for backtracking
+    while(n < name_size) {
+        if(p < pattern_size && pattern[p] == '*') {
+            star = p++;
+            star_n = n;
+            continue;
+        }
+        if(p < pattern_size && pattern[p] == '[') {
+            // Character class
+            size_t q = p + 1;
+            bool negate = q < pattern_size && (pattern[q] == '!' || pattern[q] == '^');
+            if(negate) q++;
+            bool matched = false;
+            size_t start = q;
+            while(q < pattern_size && (pattern[q] != ']' || q == start)) {
+                if(q + 2 < pattern_size && pattern[q + 1] == '-' && pattern[q + 2] != ']') {
+                    matched |= name[n] >= pattern[q] && name[n] <= pattern[q + 2];
+                    q += 3;
+                } else {
+                    matched |= name[n] == pattern[q];
+                    q++;
+                }
+            }
+            if(q < pattern_size && matched != negate) {
+                p = q + 1;
+                n++;
+                continue;
+            }
+        }
+        else if(p < pattern_size && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+            continue;
+        }
+
+        // Mismatch, let the last star take one more character
+        if(star == (size_t)-1) return false;
+        p = star + 1;
+        n = ++star_n;
     }
+    while(p < pattern_size && pattern[p] == '*') p++;
+    return p == pattern_size;
+}
 
-    return LoadImageFromMemory(ext, get_file_binary(file, pkg), file.size);
+// Length of a segment before its first wildcard
+size_t _m_literal_size(_m_segment segment) {
+    size_t i = 0;
+    while(i < segment.size && segment.text[i] != '*' && segment.text[i] != '?' && segment.text[i] != '[') i++;
+    return i;
 }
 
-// Load an image from a path in the package
-Image m_load_image(package pkg, const char * path) {
-    m_file * file = get_file(pkg, path);
-    if(file) {
-        return m_load_image(pkg, *file);
-    } 
-    else {
-        TraceLog(LOG_WARNING, "File not found: %s", path);
-        return {};
+// Split a pattern into segments, returns false if it is too deep
+bool _m_split_pattern(_m_query * query, const char * pattern) {
+    query->segment_count = 0;
+    while(*pattern) {
+        const char * end = strchr(pattern, '/');
+        size_t size = end ? (size_t)(end - pattern) : strlen(pattern);
+        bool globstar = size == 2 && pattern[0] == '*' && pattern[1] == '*';
+        bool repeated = globstar && query->segment_count
+            && query->segments[query->segment_count - 1].size == 2
+            && memcmp(query->segments[query->segment_count - 1].text, "**", 2) == 0;
+        if(size && !repeated) {
+            if(query->segment_count == M_QUERY_MAX_DEPTH) return false;
+            query->segments[query->segment_count].text = pattern;
+            query->segments[query->segment_count].size = size;
+            query->segment_count++;
+        }
+        pattern += size + (end ? 1 : 0);
     }
+    return true;
 }
 
-// Load a texture from a file in the package
-Texture2D m_load_texture(package pkg, m_file file) {
-    Image img = m_load_image(pkg, file);
-    if(img.data) {
-        Texture2D texture = LoadTextureFromImage(img);
-        UnloadImage(img); // Free image data after loading texture
-        return texture;
-    } 
-    else {
-        TraceLog(LOG_WARNING, "Failed to load image from file: %s", file.name);
-        return {};
+// Append a name to the query path, returns the new length (0 if out of memory)
+size_t _m_push_path(_m_query * query, size_t length, const char * name, size_t name_size, bool folder) {
+    if(length + name_size + 2 > query->path_size) {
+        size_t size = query->path_size;
+        while(length + name_size + 2 > size) size *= 2;
+        char * path = (char *)realloc(query->path, size);
+        if(!path) {
+            fprintf(stderr, "Failed to query: out of memory for a path of %zu bytes\n", length + name_size + 1);
+            return 0;
+        }
+        query->path = path;
+        query->path_size = size;
     }
+    memcpy(query->path + length, name, name_size);
+    length += name_size;
+    if(folder) query->path[length++] = '/';
+    query->path[length] = '\0';
+    return length;
 }
 
-// Load a texture from a file in the package
-Texture2D m_load_texture(package pkg, const char * path) {
-    m_file * file = get_file(pkg, path);
-    if(file) {
-        return m_load_texture(pkg, *file);
-    } 
+bool _m_is_globstar(_m_segment segment) {
+    return segment.size == 2 && segment.text[0] == '*' && segment.text[1] == '*';
+}
+
+// Report every file below a folder
+bool _m_query_all(_m_query * query, m_folder * folder, size_t length) {
+    load_folder(folder);
+    for(unsigned int i = 0; i < folder->file_count; ++i) {
+        if(!_m_push_path(query, length, folder->files[i].name, folder->files[i].name_size, false)) continue;
+        if(!query->callback(query->path, &folder->files[i], query->user)) return false;
+    }
+    for(unsigned int i = 0; i < folder->folder_count; ++i) {
+        m_folder * subfolder = &folder->subfolders[i];
+        size_t sub_length = _m_push_path(query, length, subfolder->name, subfolder->name_size, true);
+        if(sub_length && !_m_query_all(query, subfolder, sub_length)) return false;
+    }
+    return true;
+}
+
+// Walk a folder against the pattern from a segment on
+bool _m_query_folder(_m_query * query, m_folder * folder, unsigned int index, size_t length) {
+    if(index == query->segment_count) return true;
+    load_folder(folder);
+    _m_segment segment = query->segments[index];
+    bool last = index + 1 == query->segment_count;
+
+    if(_m_is_globstar(segment)) {
+        if(last) return _m_query_all(query, folder, length);
+
+        // Match zero folders, then one or more
+        if(!_m_query_folder(query, folder, index + 1, length)) return false;
+        for(unsigned int i = 0; i < folder->folder_count; ++i) {
+            m_folder * subfolder = &folder->subfolders[i];
+            size_t sub_length = _m_push_path(query, length, subfolder->name, subfolder->name_size, true);
+            if(sub_length && !_m_query_folder(query, subfolder, index, sub_length)) return false;
+        }
+        return true;
+    }
+
+    if(last) {
+        for(unsigned int i = 0; i < folder->file_count; ++i) {
+            m_file * file = &folder->files[i];
+            if(!m_glob_match(segment.text, segment.size, file->name, file->name_size)) continue;
+            if(!_m_push_path(query, length, file->name, file->name_size, false)) continue;
+            if(!query->callback(query->path, file, query->user)) return false;
+        }
+        return true;
+    }
+
+    // Only descend into matching subfolders
+    for(unsigned int i = 0; i < folder->folder_count; ++i) {
+        m_folder * subfolder = &folder->subfolders[i];
+        if(!m_glob_match(segment.text, segment.size, subfolder->name, subfolder->name_size)) continue;
+        size_t sub_length = _m_push_path(query, length, subfolder->name, subfolder->name_size, true);
+        if(sub_length && !_m_query_folder(query, subfolder, index + 1, sub_length)) return false;
+    }
+    return true;
+}
+
+// First record in a sorted run whose name is not below a key
+uint32_t _m_view_lower_bound(m_view view, const uint8_t * records, size_t stride, uint32_t count, const char * key, size_t key_size) {
+    uint32_t low = 0, high = count;
+    while(low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        uint32_t name = *(const uint32_t *)(records + mid * stride); // Name is the first field of every record
+        if(_m_view_compare(view, name, key, key_size) < 0) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Check if a view record name starts with a key
+bool _m_view_has_prefix(m_view view, uint32_t name, const char * key, size_t key_size) {
+    const uint8_t * string = _m_view_string(view, name);
+    return string && string[0] >= key_size && memcmp(string + 1, key, key_size) == 0;
+}
+
+// Get the package folder of a view subfolder, null if the package doesn't have it
+// Packages load folders in record order, so a record's children are at the same indices
+m_folder * _m_package_subfolder(m_folder * loaded, uint32_t index) {
+    if(!loaded) return NULL;
+    load_folder(loaded);
+    return index < loaded->folder_count ? &loaded->subfolders[index] : NULL;
+}
+
+// Call back with a matched file record, or with the package's file when querying a package
+bool _m_view_report(_m_query * query, const m_file_record * file, m_folder * loaded, uint32_t index) {
+    if(!query->callback) return query->view_callback(query->path, file, query->user);
+    if(!loaded) return true;
+    load_folder(loaded);
+    if(index >= loaded->file_count) return true;
+    return query->callback(query->path, &loaded->files[index], query->user);
+}
+
+// Report every file below a view folder, loaded is the matching package folder when querying a package
+bool _m_view_query_all(_m_query * query, const m_folder_record * folder, m_folder * loaded, size_t length) {
+    m_view view = query->view;
+    if(!_m_view_children_valid(view, folder)) return true;
+    const m_file_record * files = view.files + m_le32(folder->first_file);
+    for(uint32_t i = 0; i < m_le32(folder->file_count); ++i) {
+        const uint8_t * name = _m_view_string(view, files[i].name);
+        if(!name) continue;
+        if(!_m_push_path(query, length, (const char *)name + 1, name[0], false)) continue;
+        if(!_m_view_report(query, &files[i], loaded, i)) return false;
+    }
+    const m_folder_record * folders = view.folders + m_le32(folder->first_folder);
+    for(uint32_t i = 0; i < m_le32(folder->folder_count); ++i) {
+        const uint8_t * name = _m_view_string(view, folders[i].name);
+        m_folder * subfolder = _m_package_subfolder(loaded, i);
+        if(!name || (query->callback && !subfolder)) continue;
+        size_t sub_length = _m_push_path(query, length, (const char *)name + 1, name[0], true);
+        if(sub_length && !_m_view_query_all(query, &folders[i], subfolder, sub_length)) return false;
+    }
+    return true;
+}
+
+// Walk a view folder against the pattern, literal name prefixes are found with the sorted index
+bool _m_view_query_folder(_m_query * query, const m_folder_record * folder, m_folder * loaded, unsigned int index, size_t length) {
+    if(index == query->segment_count) return true;
+    m_view view = query->view;
+    if(!_m_view_children_valid(view, folder)) return true;
+    _m_segment segment = query->segments[index];
+    bool last = index + 1 == query->segment_count;
+    const m_folder_record * folders = view.folders + m_le32(folder->first_folder);
+    uint32_t folder_count = m_le32(folder->folder_count);
+
+    if(_m_is_globstar(segment)) {
+        if(last) return _m_view_query_all(query, folder, loaded, length);
+
+        // Match zero folders, then one or more
+        if(!_m_view_query_folder(query, folder, loaded, index + 1, length)) return false;
+        for(uint32_t i = 0; i < folder_count; ++i) {
+            const uint8_t * name = _m_view_string(view, folders[i].name);
+            m_folder * subfolder = _m_package_subfolder(loaded, i);
+            if(!name || (query->callback && !subfolder)) continue;
+            size_t sub_length = _m_push_path(query, length, (const char *)name + 1, name[0], true);
+            if(sub_length && !_m_view_query_folder(query, &folders[i], subfolder, index, sub_length)) return false;
+        }
+        return true;
+    }
+
+    // Only names sharing the segment's literal prefix can match
+    size_t literal = _m_literal_size(segment);
+    if(last) {
+        const m_file_record * files = view.files + m_le32(folder->first_file);
+        uint32_t file_count = m_le32(folder->file_count);
+        uint32_t i = _m_view_lower_bound(view, (const uint8_t *)files, sizeof(m_file_record), file_count, segment.text, literal);
+        for(; i < file_count && _m_view_has_prefix(view, files[i].name, segment.text, literal); ++i) {
+            const uint8_t * name = _m_view_string(view, files[i].name);
+            if(!m_glob_match(segment.text, segment.size, (const char *)name + 1, name[0])) continue;
+            if(!_m_push_path(query, length, (const char *)name + 1, name[0], false)) continue;
+            if(!_m_view_report(query, &files[i], loaded, i)) return false;
+        }
+        return true;
+    }
+
+    uint32_t i = _m_view_lower_bound(view, (const uint8_t *)folders, sizeof(m_folder_record), folder_count, segment.text, literal);
+    for(; i < folder_count && _m_view_has_prefix(view, folders[i].name, segment.text, literal); ++i) {
+        const uint8_t * name = _m_view_string(view, folders[i].name);
+        m_folder * subfolder = _m_package_subfolder(loaded, i);
+        if(!m_glob_match(segment.text, segment.size, (const char *)name + 1, name[0]) || (query->callback && !subfolder)) continue;
+        size_t sub_length = _m_push_path(query, length, (const char *)name + 1, name[0], true);
+        if(sub_length && !_m_view_query_folder(query, &folders[i], subfolder, index + 1, sub_length)) return false;
+    }
+    return true;
+}
+
+// Walk the view for a path prefix, following its complete folder names then matching the partial name
+bool _m_view_query_prefix(_m_query * query, const char * prefix, m_folder * loaded) {
+    m_view view = query->view;
+    const m_folder_record * folder = view_root(view);
+    size_t length = 0;
+    const char * end;
+    while(folder && (end = strchr(prefix, '/'))) {
+        size_t size = end - prefix;
+        if(size) {
+            const m_folder_record * parent = folder;
+            folder = view_find_folder(view, parent, prefix, size);
+            if(folder && query->callback) {
+                loaded = _m_package_subfolder(loaded, (uint32_t)(folder - (view.folders + m_le32(parent->first_folder))));
+                if(!loaded) folder = NULL;
+            }
+            if(folder) length = _m_push_path(query, length, prefix, size, true);
+            if(!length) folder = NULL;
+        }
+        prefix = end + 1;
+    }
+    if(!folder || !_m_view_children_valid(view, folder)) return true;
+
+    // Match the remaining partial name against the sorted files and subfolders
+    bool result = true;
+    size_t size = strlen(prefix);
+    const m_file_record * files = view.files + m_le32(folder->first_file);
+    uint32_t file_count = m_le32(folder->file_count);
+    uint32_t i = _m_view_lower_bound(view, (const uint8_t *)files, sizeof(m_file_record), file_count, prefix, size);
+    for(; result && i < file_count && _m_view_has_prefix(view, files[i].name, prefix, size); ++i) {
+        const uint8_t * name = _m_view_string(view, files[i].name);
+        if(_m_push_path(query, length, (const char *)name + 1, name[0], false))
+            result = _m_view_report(query, &files[i], loaded, i);
+    }
+
+    const m_folder_record * folders = view.folders + m_le32(folder->first_folder);
+    uint32_t folder_count = m_le32(folder->folder_count);
+    i = _m_view_lower_bound(view, (const uint8_t *)folders, sizeof(m_folder_record), folder_count, prefix, size);
+    for(; result && i < folder_count && _m_view_has_prefix(view, folders[i].name, prefix, size); ++i) {
+        const uint8_t * name = _m_view_string(view, folders[i].name);
+        m_folder * subfolder = _m_package_subfolder(loaded, i);
+        if(query->callback && !subfolder) continue;
+        size_t sub_length = _m_push_path(query, length, (const char *)name + 1, name[0], true);
+        if(sub_length) result = _m_view_query_all(query, &folders[i], subfolder, sub_length);
+    }
+    return result;
+}
+
+// Call back for every file in a view whose path matches a glob pattern
+bool view_query_glob(m_view view, const char * pattern, m_view_query_callback callback, void * user) {
+    _m_query * query = _m_new_query(NULL, callback, user);
+    query->view = view;
+    bool result = _m_split_pattern(query, pattern) && _m_view_query_folder(query, view_root(view), NULL, 0, 0);
+    _m_free_query(query);
+    return result;
+}
+
+// Call back for every file in a view whose path starts with a prefix
+bool view_query_prefix(m_view view, const char * prefix, m_view_query_callback callback, void * user) {
+    _m_query * query = _m_new_query(NULL, callback, user);
+    query->view = view;
+    bool result = _m_view_query_prefix(query, prefix, NULL);
+    _m_free_query(query);
+    return result;
+}
+
+// Call back for every file whose path matches a glob pattern, such as "levels/forest/**/*.png"
+// "**" matches any number of folders, returns false if the query was stopped by the callback
+// Packages unarchived from version 2 archives are walked through their sorted index
+bool query_glob(package pkg, const char * pattern, m_query_callback callback, void * user) {
+    _m_query * query = _m_new_query(callback, NULL, user);
+    bool result = _m_split_pattern(query, pattern);
+    if(result && pkg.toc) {
+        query->view = *pkg.toc;
+        result = _m_view_query_folder(query, view_root(*pkg.toc), &pkg.root, 0, 0);
+    }
+    else if(result) result = _m_query_folder(query, &pkg.root, 0, 0);
+    _m_free_query(query);
+    return result;
+}
+
+// Call back for every file whose path starts with a prefix, such as "levels/forest/"
+bool query_prefix(package pkg, const char * prefix, m_query_callback callback, void * user) {
+    _m_query * query = _m_new_query(callback, NULL, user);
+    if(pkg.toc) {
+        query->view = *pkg.toc;
+        bool result = _m_view_query_prefix(query, prefix, &pkg.root);
+        _m_free_query(query);
+        return result;
+    }
+
+    // Follow the complete folder names in the prefix
+    m_folder * folder = &pkg.root;
+    size_t length = 0;
+    const char * end;
+    while(folder && (end = strchr(prefix, '/'))) {
+        size_t size = end - prefix;
+        if(size) {
+            load_folder(folder);
+            m_folder * next = NULL;
+            for(unsigned int i = 0; i < folder->folder_count && !next; ++i) {
+                if(folder->subfolders[i].name_size == size && memcmp(folder->subfolders[i].name, prefix, size) == 0)
+                    next = &folder->subfolders[i];
+            }
+            folder = next;
+            if(folder) length = _m_push_path(query, length, prefix, size, true);
+            if(!length) folder = NULL;
+        }
+        prefix = end + 1;
+    }
+
+    // Match the remaining partial name against files and whole subtrees
+    bool result = true;
+    size_t size = strlen(prefix);
+    if(folder) load_folder(folder);
+    for(unsigned int i = 0; folder && result && i < folder->file_count; ++i) {
+        m_file * file = &folder->files[i];
+        if(file->name_size < size || memcmp(file->name, prefix, size) != 0) continue;
+        if(_m_push_path(query, length, file->name, file->name_size, false))
+            result = callback(query->path, file, user);
+    }
+    for(unsigned int i = 0; folder && result && i < folder->folder_count; ++i) {
+        m_folder * subfolder = &folder->subfolders[i];
+        if(subfolder->name_size < size || memcmp(subfolder->name, prefix, size) != 0) continue;
+        size_t sub_length = _m_push_path(query, length, subfolder->name, subfolder->name_size, true);
+        if(sub_length) result = _m_query_all(query, subfolder, sub_length);
+    }
+
+    _m_free_query(query);
+    return result;
+}
+
+// - Package analysis functions -
+
+#define M_ANALYSIS_BUCKETS 10
+
+// Upper bounds of the analysis buckets, the last bucket holds everything larger
+const uint64_t m_fanout_limits[M_ANALYSIS_BUCKETS - 1] = { 0, 1, 4, 16, 64, 256, 1024, 4096, 16384 };
+const uint64_t m_size_limits[M_ANALYSIS_BUCKETS - 1] = { 0, 1023, 4095, 16383, 65535, 262143, 1048575, 4194303, 16777215 };
+
+// Layout statistics of an archive
+typedef struct m_analysis {
+    uint32_t version;
+    uint32_t volume_count;
+    uint64_t archive_size;          // Bytes in every volume
+    uint64_t toc_size;              // Header and table of contents (structure for version 1)
+    uint64_t data_size;
+    unsigned long folder_count, file_count;
+
+    // Entries (files and subfolders) per folder, bucketed by m_fanout_limits
+    unsigned long fanout[M_ANALYSIS_BUCKETS];
+    unsigned long max_fanout;
+    char max_fanout_path[1024];     // Folder with the most entries, the worst linear scan
+    double mean_fanout;
+
+    // File sizes, bucketed by m_size_limits
+    unsigned long sizes[M_ANALYSIS_BUCKETS];
+    uint64_t size_bytes[M_ANALYSIS_BUCKETS];
+
+    unsigned long duplicate_files;  // Files whose content is stored again elsewhere
+    uint64_t duplicate_bytes;
+
+    unsigned long misaligned;       // Payloads not aligned to M_V2_ALIGN in their archive file
+    uint64_t misaligned_bytes;
+    unsigned long unaligned_pages;  // Payloads of a page or more that don't start on a page
+
+    // Average name comparisons per file lookup, misses are for a missing name next to an existing file
+    double linear_hit, linear_miss; // Folder scans (get_entry_in_folder)
+    double binary_hit, binary_miss; // Binary searches (views, version 2 only)
+} m_analysis;
+
+typedef struct _m_analyzer {
+    m_analysis * analysis;
+    package * pkg;
+    _m_payload * payloads;
+    unsigned long payload_count;
+    unsigned long payload_capacity;
+    char path[1024];
+    double linear_hit, linear_miss, binary_hit, binary_miss;
+} _m_analyzer;
+
+unsigned int _m_bucket(const uint64_t * limits, uint64_t value) {
+    unsigned int bucket = 0;
+    while(bucket < M_ANALYSIS_BUCKETS - 1 && value > limits[bucket]) bucket++;
+    return bucket;
+}
+
+// Comparisons a view binary search makes to find an index in a sorted run
+unsigned int _m_binary_steps(uint32_t count, uint32_t index) {
+    uint32_t low = 0, high = count;
+    unsigned int steps = 0;
+    while(low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        steps++;
+        if(mid == index) break;
+        if(mid < index) low = mid + 1;
+        else high = mid;
+    }
+    return steps;
+}
+
+// Comparisons a view binary search makes before missing in a sorted run
+unsigned int _m_binary_miss(uint32_t count) {
+    unsigned int steps = 0;
+    while(count) {
+        count /= 2;
+        steps++;
+    }
+    return steps;
+}
+
+// Walk a folder, linear and binary are the comparisons made to reach it
+void _m_analyze_folder(_m_analyzer * analyzer, m_folder * folder, size_t length, unsigned long linear, unsigned long binary) {
+    m_analysis * analysis = analyzer->analysis;
+    load_folder(folder);
+    analysis->folder_count++;
+
+    unsigned long entries = folder->file_count + folder->folder_count;
+    analysis->fanout[_m_bucket(m_fanout_limits, entries)]++;
+    analysis->mean_fanout += entries;
+    if(entries > analysis->max_fanout || analysis->folder_count == 1) {
+        analysis->max_fanout = entries;
+        snprintf(analysis->max_fanout_path, sizeof(analysis->max_fanout_path), "%.*s", (int)length, analyzer->path);
+    }
+
+    for(unsigned int i = 0; i < folder->file_count; ++i) {
+        m_file * file = &folder->files[i];
+        unsigned int bucket = _m_bucket(m_size_limits, file->size);
+        analysis->sizes[bucket]++;
+        analysis->size_bytes[bucket] += file->size;
+
+        if(analyzer->payload_count == analyzer->payload_capacity) {
+            analyzer->payload_capacity = analyzer->payload_capacity ? analyzer->payload_capacity * 2 : 64;
+            analyzer->payloads = (_m_payload *)realloc(analyzer->payloads, sizeof(_m_payload) * analyzer->payload_capacity);
+        }
+        _m_payload * payload = &analyzer->payloads[analyzer->payload_count++];
+        payload->offset = file->offset;
+        payload->size = file->size;
+        payload->hash = m_hash(analyzer->pkg->data + file->offset, file->size);
+
+        // Files are checked before subfolders by a folder scan
+        analyzer->linear_hit += linear + i + 1;
+        analyzer->linear_miss += linear + entries;
+        analyzer->binary_hit += binary + _m_binary_steps(folder->file_count, i);
+        analyzer->binary_miss += binary + _m_binary_miss(folder->file_count);
+    }
+
+    for(unsigned int i = 0; i < folder->folder_count; ++i) {
+        m_folder * subfolder = &folder->subfolders[i];
+        size_t sublength = length + snprintf(analyzer->path + length, sizeof(analyzer->path) - length, "%s/", subfolder->name);
+        if(sublength >= sizeof(analyzer->path)) sublength = sizeof(analyzer->path) - 1;
+        _m_analyze_folder(analyzer, subfolder, sublength, linear + folder->file_count + i + 1, binary + _m_binary_steps(folder->folder_count, i));
+    }
+}
+
+int _m_compare_payload_contents(const void * a, const void * b) {
+    const _m_payload * pa = (const _m_payload *)a, * pb = (const _m_payload *)b;
+    if(pa->size != pb->size) return pa->size < pb->size ? -1 : 1;
+    return (pa->hash > pb->hash) - (pa->hash < pb->hash);
+}
+
+// Count a payload's alignment in its archive file
+void _m_analyze_alignment(m_analysis * analysis, uint64_t position, uint64_t size) {
+    if(size == 0) return;
+    if(position % M_V2_ALIGN) {
+        analysis->misaligned++;
+        analysis->misaligned_bytes += size;
+    }
+    if(size >= 4096 && position % 4096)
+        analysis->unaligned_pages++;
+}
+
+// Size of a file in bytes (0 if it can't be opened)
+uint64_t _m_file_size(const char * filename) {
+    FILE * f = fopen(filename, "rb");
+    if(!f) return 0;
+    fseek(f, 0L, SEEK_END);
+    uint64_t size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+// Analyze the layout of an archive file (the first volume of multi-volume archives)
+bool analyze_archive(const char * filename, m_analysis * analysis) {
+    m_analysis empty = {};
+    *analysis = empty;
+    package pkg = load_package(filename);
+    if(!pkg.data) return false;
+
+    analysis->version = pkg.version ? pkg.version : M_VERSION_1;
+    analysis->volume_count = pkg.toc ? view_volume_count(*pkg.toc) : 1;
+    analysis->data_size = pkg.data_size;
+    analysis->toc_size = pkg.toc ? sizeof(m_archive_header) + m_le64(pkg.toc->header->toc_size) : pkg.struct_size;
+    for(uint32_t i = 0; i < analysis->volume_count; ++i) {
+        char volume_filename[1024];
+        if(analysis->volume_count > 1) archive_volume_filename(volume_filename, sizeof(volume_filename), filename, i);
+        else snprintf(volume_filename, sizeof(volume_filename), "%s", filename);
+        analysis->archive_size += _m_file_size(volume_filename);
+    }
+
+    // Walk the tree
+    _m_analyzer analyzer = {};
+    analyzer.analysis = analysis;
+    analyzer.pkg = &pkg;
+    _m_analyze_folder(&analyzer, &pkg.root, 0, 0, 0);
+    analysis->file_count = analyzer.payload_count;
+    analysis->mean_fanout /= analysis->folder_count;
+    if(analysis->file_count) {
+        analysis->linear_hit = analyzer.linear_hit / analysis->file_count;
+        analysis->linear_miss = analyzer.linear_miss / analysis->file_count;
+        if(pkg.version == M_VERSION_2) {
+            analysis->binary_hit = analyzer.binary_hit / analysis->file_count;
+            analysis->binary_miss = analyzer.binary_miss / analysis->file_count;
+        }
+    }
+
+    // Duplicate content, payloads shared by several files are only stored once
+    qsort(analyzer.payloads, analyzer.payload_count, sizeof(_m_payload), _m_compare_payload_offsets);
+    unsigned long stored = 0;
+    for(unsigned long i = 0; i < analyzer.payload_count; ++i) {
+        if(stored && analyzer.payloads[stored - 1].offset == analyzer.payloads[i].offset && analyzer.payloads[stored - 1].size == analyzer.payloads[i].size)
+            continue;
+        analyzer.payloads[stored++] = analyzer.payloads[i];
+    }
+    qsort(analyzer.payloads, stored, sizeof(_m_payload), _m_compare_payload_contents);
+    for(unsigned long i = 1; i < stored; ++i) {
+        if(analyzer.payloads[i].size && _m_compare_payload_contents(&analyzer.payloads[i - 1], &analyzer.payloads[i]) == 0) {
+            analysis->duplicate_files++;
+            analysis->duplicate_bytes += analyzer.payloads[i].size;
+        }
+    }
+
+    // Alignment within each archive file
+    if(pkg.toc) {
+        for(uint32_t i = 0; i < m_le32(pkg.toc->header->file_count); ++i) {
+            const m_file_record * record = &pkg.toc->files[i];
+            uint64_t base = m_le32(record->volume) == 0 ? pkg.data_offset : sizeof(m_archive_header);
+            _m_analyze_alignment(analysis, base + m_le64(record->offset), m_le64(record->size));
+        }
+    }
     else {
-        TraceLog(LOG_WARNING, "File not found: %s", path);
-        return {};
+        for(unsigned long i = 0; i < stored; ++i)
+            _m_analyze_alignment(analysis, pkg.data_offset + analyzer.payloads[i].offset, analyzer.payloads[i].size);
+    }
+
+    free(analyzer.payloads);
+    free_package(pkg);
+    return true;
+}
+
+// - Package patching functions -
+
+#define M_PATCH_VERSION 2
+#define M_PATCH_HEAD_SIZE (4+4+8+8+8+8) // ID + version + old archive size + new archive size + old hash + new hash
+#define M_PATCH_BLOCK_SIZE 64           // Block size used to find matches in changed files
+#define M_PATCH_CHUNK_SIZE 65536        // Buffer size used when streaming a patch
+#define M_PATCH_MAX_CANDIDATES 16       // Old blocks kept per hash bucket, later repeats are skipped
+#define M_PATCH_GOOD_MATCH 4096         // Match size accepted without checking the other candidates
+
+// Patch operations, each rebuilds the next bytes of the new archive
+#define M_PATCH_OP_COPY 'C' // Copy a byte range from the old archive
+#define M_PATCH_OP_DATA 'D' // Insert literal bytes stored in the patch
+#define M_PATCH_OP_END  'E' // End of the patch
+
+// Patch writer, merges neighbouring operations before writing them
+typedef struct _m_patch_writer {
+    FILE * f;
+    char op;                // Pending operation (0 if none)
+    uint64_t offset;        // Old archive offset of a pending copy
+    uint64_t size;          // Size of the pending operation
+    const uint8_t * data;   // Literal bytes of a pending data operation
+    bool failed;            // Set when a write fails
+} _m_patch_writer;
+
+// Write out the pending patch operation
+void _m_patch_flush(_m_patch_writer * w) {
+    if(w->op == M_PATCH_OP_COPY) {
+        if(fputc(M_PATCH_OP_COPY, w->f) == EOF || !_m_write_u64(w->f, w->offset) || !_m_write_u64(w->f, w->size))
+            w->failed = true;
+    }
+    else if(w->op == M_PATCH_OP_DATA) {
+        if(fputc(M_PATCH_OP_DATA, w->f) == EOF || !_m_write_u64(w->f, w->size) || fwrite(w->data, 1, w->size, w->f) != w->size)
+            w->failed = true;
+    }
+    w->op = 0;
+    w->size = 0;
+}
+
+// Add a copy from the old archive to the patch
+void _m_patch_copy(_m_patch_writer * w, uint64_t offset, uint64_t size) {
+    if(size == 0) return;
+    if(w->op == M_PATCH_OP_COPY && w->offset + w->size == offset) {
+        w->size += size;
+        return;
+    }
+    _m_patch_flush(w);
+    w->op = M_PATCH_OP_COPY;
+    w->offset = offset;
+    w->size = size;
+}
+
+// Add literal bytes to the patch
+void _m_patch_data(_m_patch_writer * w, const uint8_t * data, uint64_t size) {
+    if(size == 0) return;
+    if(w->op == M_PATCH_OP_DATA && w->data + w->size == data) {
+        w->size += size;
+        return;
+    }
+    _m_patch_flush(w);
+    w->op = M_PATCH_OP_DATA;
+    w->data = data;
+    w->size = size;
+}
+
+// Rolling hash of a block (polynomial, wraps modulo 2^32)
+#define M_PATCH_HASH_BASE 0x01000193u
+uint32_t _m_block_hash(const uint8_t * data) {
+    uint32_t hash = 0;
+    for(unsigned int i = 0; i < M_PATCH_BLOCK_SIZE; ++i)
+        hash = hash * M_PATCH_HASH_BASE + data[i];
+    return hash;
+}
+
+// Binary delta of a changed region against its old version
+void _m_patch_delta(_m_patch_writer * w, const uint8_t * old_data, uint64_t old_size, uint64_t old_offset, const uint8_t * new_data, uint64_t new_size) {
+    if(old_size < M_PATCH_BLOCK_SIZE || new_size < M_PATCH_BLOCK_SIZE) {
+        _m_patch_data(w, new_data, new_size);
+        return;
+    }
+
+    // Index every aligned block of the old data by its hash
+    uint64_t block_count = old_size / M_PATCH_BLOCK_SIZE;
+    uint64_t table_size = 1;
+    while(table_size < block_count * 2) table_size <<= 1;
+    uint64_t * heads = (uint64_t *)calloc(table_size, sizeof(uint64_t));
+    uint64_t * next = (uint64_t *)malloc(sizeof(uint64_t) * block_count);
+    uint8_t * counts = (uint8_t *)calloc(table_size, 1);
+    for(uint64_t i = 0; i < block_count; ++i) {
+        uint32_t hash = _m_block_hash(old_data + i * M_PATCH_BLOCK_SIZE);
+        // Repetitive data fills a bucket quickly, more copies of it don't find better matches
+        if(counts[hash & (table_size - 1)] == M_PATCH_MAX_CANDIDATES) continue;
+        counts[hash & (table_size - 1)]++;
+        next[i] = heads[hash & (table_size - 1)];
+        heads[hash & (table_size - 1)] = i + 1; // 0 marks an empty bucket
+    }
+    free(counts);
+
+    // Weight of the byte leaving the rolling window
+    uint32_t out_weight = 1;
+    for(unsigned int i = 1; i < M_PATCH_BLOCK_SIZE; ++i)
+        out_weight *= M_PATCH_HASH_BASE;
+
+    uint64_t literal = 0;   // Start of bytes not yet covered by a copy
+    uint64_t i = 0;
+    uint32_t hash = _m_block_hash(new_data);
+    while(i + M_PATCH_BLOCK_SIZE <= new_size) {
+        // Look for an old block with the same content
+        uint64_t match = 0, match_size = 0;
+        for(uint64_t b = heads[hash & (table_size - 1)]; b; b = next[b - 1]) {
+            uint64_t offset = (b - 1) * M_PATCH_BLOCK_SIZE;
+            if(memcmp(old_data + offset, new_data + i, M_PATCH_BLOCK_SIZE) != 0)
+                continue;
+
+            // Extend the match forward as far as it goes
+            uint64_t size = M_PATCH_BLOCK_SIZE;
+            while(offset + size < old_size && i + size < new_size && old_data[offset + size] == new_data[i + size])
+                size++;
+            if(size > match_size) {
+                match = offset;
+                match_size = size;
+            }
+            if(match_size >= M_PATCH_GOOD_MATCH) break;
+        }
+
+        if(match_size) {
+            _m_patch_data(w, new_data + literal, i - literal);
+            _m_patch_copy(w, old_offset + match, match_size);
+            i += match_size;
+            literal = i;
+            if(i + M_PATCH_BLOCK_SIZE <= new_size)
+                hash = _m_block_hash(new_data + i);
+            continue;
+        }
+
+        // Roll the window forward by one byte
+        if(i + M_PATCH_BLOCK_SIZE < new_size)
+            hash = (hash - new_data[i] * out_weight) * M_PATCH_HASH_BASE + new_data[i + M_PATCH_BLOCK_SIZE];
+        i++;
     }
+    _m_patch_data(w, new_data + literal, new_size - literal);
+
+    free(heads);
+    free(next);
 }
 
+// File reference with its full path in the package
+typedef struct _m_file_ref {
+    m_file * file;
+    char * path;
+} _m_file_ref;
+
+// Collect every file in a folder with its path relative to the root
+void _m_collect_files(m_folder * folder, const char * prefix, _m_file_ref ** refs, unsigned long * count, unsigned long * capacity) {
+    load_folder(folder);
+    for(unsigned int i = 0; i < folder->file_count; ++i) {
+        if(*count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 64;
+            *refs = (_m_file_ref *)realloc(*refs, sizeof(_m_file_ref) * *capacity);
+        }
+        _m_file_ref * ref = &(*refs)[(*count)++];
+        ref->file = &folder->files[i];
+        ref->path = (char *)malloc(strlen(prefix) + folder->files[i].name_size + 1);
+        sprintf(ref->path, "%s%s", prefix, folder->files[i].name);
+    }
+
+    for(unsigned int i = 0; i < folder->folder_count; ++i) {
+        m_folder * subfolder = &folder->subfolders[i];
+        char * path = (char *)malloc(strlen(prefix) + subfolder->name_size + 2);
+        sprintf(path, "%s%s/", prefix, subfolder->name);
+        _m_collect_files(subfolder, path, refs, count, capacity);
+        free(path);
+    }
+}
+
+// Sort file references by their data offset
+int _m_compare_file_offsets(const void * a, const void * b) {
+    unsigned long offset_a = ((const _m_file_ref *)a)->file->offset;
+    unsigned long offset_b = ((const _m_file_ref *)b)->file->offset;
+    return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+// Create a patch that rebuilds new_filename from old_filename
+bool diff_archives(const char * old_filename, const char * new_filename, const char * patch_filename) {
+    archive old_arc = load_archive(old_filename);
+    archive new_arc = load_archive(new_filename);
+    if(!old_arc.data || !new_arc.data) {
+        free(old_arc.data);
+        free(new_arc.data);
+        return false;
+    }
+    package old_pkg = unarchive_package(old_arc);
+    package new_pkg = unarchive_package(new_arc);
+    if(!old_pkg.root.name || !old_pkg.data || !new_pkg.root.name || !new_pkg.data) {
+        fprintf(stderr, "Failed to unarchive %s\n", !old_pkg.root.name || !old_pkg.data ? old_filename : new_filename);
+        free_package(old_pkg);
+        free_package(new_pkg);
+        free(old_arc.data);
+        free(new_arc.data);
+        return false;
+    }
+
+    FILE * f = fopen(patch_filename, "wb");
+    if(!f) {
+        perror("Failed to save patch");
+        free_package(old_pkg);
+        free_package(new_pkg);
+        free(old_arc.data);
+        free(new_arc.data);
+        return false;
+    }
+
+    _m_patch_writer w = {};
+    w.f = f;
+
+    // Write patch header
+    uint8_t version[4] = { M_PATCH_VERSION, 0, 0, 0 };
+    if(fwrite("MPAT", 1, 4, f) != 4 || fwrite(version, 1, 4, f) != 4
+        || !_m_write_u64(f, old_arc.size) || !_m_write_u64(f, new_arc.size)
+        || !_m_write_u64(f, m_hash(old_arc.data, old_arc.size)) || !_m_write_u64(f, m_hash(new_arc.data, new_arc.size)))
+        w.failed = true;
+
+    // Package header and structure, usually close to the old one
+    _m_patch_delta(&w, old_arc.data, old_pkg.data_offset, 0, new_arc.data, new_pkg.data_offset);
+
+    // Walk the new files in data order
+    _m_file_ref * refs = NULL;
+    unsigned long count = 0, capacity = 0;
+    _m_collect_files(&new_pkg.root, "", &refs, &count, &capacity);
+    qsort(refs, count, sizeof(_m_file_ref), _m_compare_file_offsets);
+
+    unsigned long position = 0; // Data offset rebuilt so far
+    for(unsigned long i = 0; i < count; ++i) {
+        m_file * file = refs[i].file;
+        if(file->offset < position) continue; // Shared payload, already written
+        const uint8_t * new_data = new_arc.data + new_pkg.data_offset;
+
+        // Bytes between files are sent as they are
+        _m_patch_data(&w, new_data + position, file->offset - position);
+
+        m_file * old_file = get_file(old_pkg, refs[i].path);
+        if(old_file) {
+            const uint8_t * old_data = old_arc.data + old_pkg.data_offset + old_file->offset;
+            unsigned long old_offset = old_pkg.data_offset + old_file->offset;
+
+            // Unchanged payloads are copied without diffing
+            if(old_file->size == file->size && memcmp(old_data, new_data + file->offset, file->size) == 0)
+                _m_patch_copy(&w, old_offset, file->size);
+            else
+                _m_patch_delta(&w, old_data, old_file->size, old_offset, new_data + file->offset, file->size);
+        }
+        else {
+            _m_patch_data(&w, new_data + file->offset, file->size);
+        }
+        position = file->offset + file->size;
+    }
+    _m_patch_data(&w, new_arc.data + new_pkg.data_offset + position, new_arc.size - new_pkg.data_offset - position);
+
+    _m_patch_flush(&w);
+    if(fputc(M_PATCH_OP_END, w.f) == EOF) w.failed = true;
+    if(fclose(f) != 0) w.failed = true;
+    if(w.failed) {
+        perror("Failed to write patch");
+        _m_remove_output(patch_filename);
+    }
+
+    for(unsigned long i = 0; i < count; ++i)
+        free(refs[i].path);
+    free(refs);
+    free_package(old_pkg);
+    free_package(new_pkg);
+    free(old_arc.data);
+    free(new_arc.data);
+    return !w.failed;
+}
+
+// Apply a patch to an old archive, streaming the result to out_filename
+// The result is written next to out_filename and only renamed into place once its hash matches the patch
+bool apply_patch(const char * old_filename, const char * patch_filename, const char * out_filename) {
+    FILE * old_f = fopen(old_filename, "rb");
+    FILE * patch_f = fopen(patch_filename, "rb");
+    FILE * out_f = NULL;
+    uint8_t * buffer = NULL;
+    char temp_filename[1024];
+    bool success = false;
+    if(!old_f || !patch_f) {
+        perror("Failed to open patch input");
+        goto done;
+    }
+    if(snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", out_filename) >= (int)sizeof(temp_filename)) {
+        fprintf(stderr, "Output filename is too long: %s\n", out_filename);
+        goto done;
+    }
+
+    {
+        // Check the patch header
+        char id[4];
+        uint8_t version[4];
+        uint64_t old_size, new_size, old_hash, new_hash;
+        if(fread(id, 1, 4, patch_f) != 4 || memcmp(id, "MPAT", 4) != 0 || fread(version, 1, 4, patch_f) != 4) {
+            fprintf(stderr, "Invalid patch file: %s\n", patch_filename);
+            goto done;
+        }
+        if(version[0] != M_PATCH_VERSION) {
+            fprintf(stderr, "Unsupported patch version %u: %s\n", version[0], patch_filename);
+            goto done;
+        }
+        if(!_m_read_u64(patch_f, &old_size) || !_m_read_u64(patch_f, &new_size)
+            || !_m_read_u64(patch_f, &old_hash) || !_m_read_u64(patch_f, &new_hash)) {
+            fprintf(stderr, "Invalid patch file: %s\n", patch_filename);
+            goto done;
+        }
+
+        // Make sure the patch is for this archive before writing anything
+        buffer = (uint8_t *)malloc(M_PATCH_CHUNK_SIZE);
+        uint64_t hash = M_HASH_SEED, size = 0;
+        size_t chunk;
+        while((chunk = fread(buffer, 1, M_PATCH_CHUNK_SIZE, old_f)) > 0) {
+            hash = m_hash_update(hash, buffer, chunk);
+            size += chunk;
+        }
+        if(ferror(old_f)) {
+            perror("Failed to read archive");
+            goto done;
+        }
+        if(size != old_size || hash != old_hash) {
+            fprintf(stderr, "Patch does not match archive: %s\n", old_filename);
+            goto done;
+        }
+
+        out_f = fopen(temp_filename, "wb");
+        if(!out_f) {
+            perror("Failed to save patched archive");
+            goto done;
+        }
+
+        // Run the operations
+        uint64_t written = 0;
+        hash = M_HASH_SEED;
+        int op;
+        while((op = fgetc(patch_f)) != EOF && op != M_PATCH_OP_END) {
+            uint64_t offset = 0, size = 0;
+            FILE * source = patch_f;
+            if(op == M_PATCH_OP_COPY) {
+                if(!_m_read_u64(patch_f, &offset) || !_m_read_u64(patch_f, &size) || offset > old_size || size > old_size - offset)
+                    break;
+                fseek(old_f, offset, SEEK_SET);
+                source = old_f;
+            }
+            else if(op != M_PATCH_OP_DATA || !_m_read_u64(patch_f, &size)) {
+                break;
+            }
+
+            // Stream the range in chunks
+            while(size > 0) {
+                size_t chunk = size < M_PATCH_CHUNK_SIZE ? size : M_PATCH_CHUNK_SIZE;
+                if(fread(buffer, 1, chunk, source) != chunk) break;
+                if(fwrite(buffer, 1, chunk, out_f) != chunk) {
+                    perror("Failed to write patched archive");
+                    goto done;
+                }
+                hash = m_hash_update(hash, buffer, chunk);
+                size -= chunk;
+                written += chunk;
+            }
+            if(size > 0) break;
+        }
+
+        if(op != M_PATCH_OP_END || written != new_size) {
+            fprintf(stderr, "Corrupt patch file: %s\n", patch_filename);
+            goto done;
+        }
+        if(hash != new_hash) {
+            fprintf(stderr, "Patched archive does not match the patch: %s\n", patch_filename);
+            goto done;
+        }
+
+        int closed = fclose(out_f);
+        out_f = NULL;
+        if(closed != 0) {
+            perror("Failed to write patched archive");
+            goto done;
+        }
+        if(rename(temp_filename, out_filename) != 0) {
+            perror("Failed to save patched archive");
+            goto done;
+        }
+        success = true;
+    }
+
+done:
+    if(old_f) fclose(old_f);
+    if(patch_f) fclose(patch_f);
+    if(out_f) fclose(out_f);
+    if(!success && old_f && patch_f) _m_remove_output(temp_filename);
+    free(buffer);
+    return success;
+}
+
+// - Tar import functions -
+
+// Tar streams are imported in one pass, without extracting them. Payloads are written to the
+// archive as they arrive, after a placeholder header, while the folder tree is built in memory.
+// The table of contents goes after the data once the stream ends, then the header is filled in.
+
+#define M_TAR_BLOCK 512
+
+typedef struct _m_tar_file {
+    uint64_t offset;
+    uint64_t hash;
+} _m_tar_file;
+
+// Parse a tar number field, octal or base 256 when the high bit is set
+uint64_t _m_tar_number(const uint8_t * field, size_t size) {
+    uint64_t value = 0;
+    if(field[0] & 0x80) {
+        value = field[0] & 0x7F;
+        for(size_t i = 1; i < size; ++i)
+            value = (value << 8) | field[i];
+        return value;
+    }
+    for(size_t i = 0; i < size && field[i]; ++i) {
+        if(field[i] >= '0' && field[i] <= '7') value = value * 8 + (field[i] - '0');
+        else if(field[i] != ' ') break;
+    }
+    return value;
+}
+
+// Check the header checksum of a tar block
+bool _m_tar_checksum(const uint8_t * block) {
+    uint64_t sum = 0;
+    for(int i = 0; i < M_TAR_BLOCK; ++i)
+        sum += i >= 148 && i < 156 ? ' ' : block[i];
+    return sum == _m_tar_number(block + 148, 8);
+}
+
+// Read exactly size bytes, feeding them through an optional output and hash
+bool _m_tar_read(FILE * tar, uint64_t size, uint8_t * into, FILE * out, uint64_t * hash) {
+    uint8_t buffer[M_PATCH_CHUNK_SIZE];
+    while(size > 0) {
+        size_t chunk = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+        uint8_t * data = into ? into : buffer;
+        if(fread(data, 1, chunk, tar) != chunk) return false;
+        if(out && fwrite(data, 1, chunk, out) != chunk) return false;
+        if(hash) *hash = m_hash_update(*hash, data, chunk);
+        if(into) into += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// Make room for one more file or subfolder, arrays double in size whenever the count is a power of two
+void * _m_tar_grow(void * array, unsigned int count, size_t size) {
+    if(count == 0 || (count & (count - 1)) == 0)
+        array = realloc(array, size * (count ? count * 2 : 1));
+    return array;
+}
+
+// Get a subfolder by name, creating it if needed
+m_folder * _m_tar_folder(m_folder * folder, const char * name, size_t name_size) {
+    for(unsigned int i = 0; i < folder->folder_count; ++i) {
+        if(folder->subfolders[i].name_size == name_size && memcmp(folder->subfolders[i].name, name, name_size) == 0)
+            return &folder->subfolders[i];
+    }
+    folder->subfolders = (m_folder *)_m_tar_grow(folder->subfolders, folder->folder_count, sizeof(m_folder));
+    m_folder * subfolder = &folder->subfolders[folder->folder_count++];
+    m_folder empty = {};
+    *subfolder = empty;
+    subfolder->name_size = name_size;
+    subfolder->name = (char *)malloc(name_size + 1);
+    memcpy(subfolder->name, name, name_size);
+    subfolder->name[name_size] = '\0';
+    return subfolder;
+}
+
+// Add a file or folder by path, returns the file (null for folders or invalid paths)
+m_file * _m_tar_entry(m_folder * root, const char * path, bool is_folder) {
+    m_folder * folder = root;
+    while(*path) {
+        const char * end = strchr(path, '/');
+        size_t size = end ? (size_t)(end - path) : strlen(path);
+        bool last = !end || end[1] == '\0';
+        if(size > 255 || (size == 2 && memcmp(path, "..", 2) == 0)) {
+            fprintf(stderr, "Skipping tar entry with an unsupported path: %s\n", path);
+            return NULL;
+        }
+
+        if(size == 0 || (size == 1 && path[0] == '.')) {
+            // Skip empty and current folder components
+        }
+        else if(!last || is_folder)
+            folder = _m_tar_folder(folder, path, size);
+        else {
+            // A later entry for the same path replaces the earlier one
+            for(unsigned int i = 0; i < folder->file_count; ++i) {
+                if(folder->files[i].name_size == size && memcmp(folder->files[i].name, path, size) == 0)
+                    return &folder->files[i];
+            }
+            folder->files = (m_file *)_m_tar_grow(folder->files, folder->file_count, sizeof(m_file));
+            m_file * file = &folder->files[folder->file_count++];
+            file->name_size = size;
+            file->name = (char *)malloc(size + 1);
+            memcpy(file->name, path, size);
+            file->name[size] = '\0';
+            return file;
+        }
+        path += size + (end ? 1 : 0);
+    }
+    return NULL;
+}
+
+int _m_compare_tar_files(const void * a, const void * b) {
+    uint64_t offset_a = ((const _m_tar_file *)a)->offset, offset_b = ((const _m_tar_file *)b)->offset;
+    return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+// Import a tar stream (ustar, GNU or pax) into a version 2 archive in a single pass
+// The archive must be seekable, the tar stream doesn't have to be (such as stdin)
+// Regular files and folders are imported, links and special files are skipped
+// id is the optional package ID (null for the default), file_count is set to the files imported (may be null)
+bool import_tar(FILE * tar, const char * archive_filename, const char * id, unsigned long * file_count) {
+    FILE * out = fopen(archive_filename, "wb");
+    if(!out) {
+        perror("Failed to create archive");
+        return false;
+    }
+
+    // Root folder named after the archive
+    package pkg = {};
+    memcpy(pkg.id, "MPAK", 4);
+    if(id) {
+        size_t id_size = strlen(id);
+        memset(pkg.id, 0, 4);
+        memcpy(pkg.id, id, id_size < 4 ? id_size : 4);
+    }
+    pkg.version = M_VERSION_2;
+    const char * root_name = strrchr(archive_filename, '/');
+    root_name = root_name ? root_name + 1 : archive_filename;
+    const char * extension = strrchr(root_name, '.');
+    size_t root_size = extension && extension != root_name ? (size_t)(extension - root_name) : strlen(root_name);
+    if(root_size > 255) root_size = 255;
+    pkg.root.name_size = root_size;
+    pkg.root.name = (char *)malloc(root_size + 1);
+    memcpy(pkg.root.name, root_name, root_size);
+    pkg.root.name[root_size] = '\0';
+
+    // Payloads go straight after the header placeholder
+    m_archive_header header = {};
+    bool success = fwrite(&header, sizeof(header), 1, out) == 1;
+    uint64_t data_offset = sizeof(header);
+
+    _m_tar_file * files = NULL;
+    unsigned long count = 0, capacity = 0, imported = 0;
+    char * long_name = NULL;    // Name of the next entry from a GNU or pax extension header
+    bool reject_next = false;   // Set when the extension header for the next entry is malformed
+    uint8_t block[M_TAR_BLOCK];
+    while(success) {
+        if(fread(block, 1, M_TAR_BLOCK, tar) != M_TAR_BLOCK) {
+            fprintf(stderr, "Failed to import tar: unexpected end of stream\n");
+            success = false;
+            break;
+        }
+
+        // Stop at the first zero block
+        bool zero = true;
+        for(int i = 0; i < M_TAR_BLOCK && zero; ++i)
+            zero = block[i] == 0;
+        if(zero) break;
+        if(!_m_tar_checksum(block)) {
+            fprintf(stderr, "Failed to import tar: bad header checksum\n");
+            success = false;
+            break;
+        }
+
+        char type = block[156];
+        uint64_t size = _m_tar_number(block + 124, 12);
+        uint64_t padding = (M_TAR_BLOCK - size % M_TAR_BLOCK) % M_TAR_BLOCK;
+
+        // Full name, from an extension header or the prefix and name fields
+        char name[512];
+        bool skip = false;  // Set if the name doesn't fit or its extension header was rejected
+        if(reject_next && type != 'L' && type != 'x') {
+            skip = true;
+            reject_next = false;
+            name[0] = '\0';
+            free(long_name);
+            long_name = NULL;
+        }
+        else if(long_name) {
+            size_t name_size = strlen(long_name);
+            if(name_size >= sizeof(name)) {
+                fprintf(stderr, "Skipping tar entry with a path over %d bytes: %.64s...\n", (int)sizeof(name) - 1, long_name);
+                skip = true;
+                name_size = 0;
+            }
+            memcpy(name, long_name, name_size);
+            name[name_size] = '\0';
+            free(long_name);
+            long_name = NULL;
+        }
+        else if(memcmp(block + 257, "ustar", 5) == 0 && block[345])
+            snprintf(name, sizeof(name), "%.155s/%.100s", (const char *)block + 345, (const char *)block);
+        else
+            snprintf(name, sizeof(name), "%.100s", (const char *)block);
+
+        if(type == 'L' || type == 'x') {
+            // GNU long name or pax extended header for the next entry
+            char * extension_data = size < SIZE_MAX ? (char *)malloc(size + 1) : NULL;
+            if(!extension_data) {
+                fprintf(stderr, "Skipping tar entry with an extension header of %llu bytes\n", (unsigned long long)size);
+                reject_next = true;
+                success = _m_tar_read(tar, size + padding, NULL, NULL, NULL);
+            }
+            else {
+                success = _m_tar_read(tar, size, (uint8_t *)extension_data, NULL, NULL)
+                    && _m_tar_read(tar, padding, NULL, NULL, NULL);
+                extension_data[size] = '\0';
+            }
+            if(!extension_data) {
+                // Already reported
+            }
+            else if(type == 'L') {
+                free(long_name);
+                long_name = extension_data;
+            }
+            else {
+                // Records are "<length> <key>=<value>\n", the length counts the whole record
+                char * extension_end = extension_data + size;
+                for(char * record = extension_data; success && record < extension_end;) {
+                    char * end_ptr;
+                    unsigned long length = strtoul(record, &end_ptr, 10);
+                    if(end_ptr == record || length == 0 || length > (unsigned long)(extension_end - record) || end_ptr >= record + length) {
+                        fprintf(stderr, "Skipping tar entry with a malformed pax header\n");
+                        reject_next = true;
+                        break;
+                    }
+                    if(strncmp(end_ptr, " path=", 6) == 0) {
+                        if(end_ptr + 6 > record + length - 1) {
+                            fprintf(stderr, "Skipping tar entry with a malformed pax header\n");
+                            reject_next = true;
+                            break;
+                        }
+                        free(long_name);
+                        size_t value_size = record + length - 1 - (end_ptr + 6);
+                        long_name = (char *)malloc(value_size + 1);
+                        if(!long_name) {
+                            fprintf(stderr, "Skipping tar entry with a path of %zu bytes\n", value_size);
+                            reject_next = true;
+                            break;
+                        }
+                        memcpy(long_name, end_ptr + 6, value_size);
+                        long_name[value_size] = '\0';
+                    }
+                    record += length;
+                }
+                free(extension_data);
+            }
+        }
+        else if(type == '0' || type == '\0' || type == '7') {
+            // Regular file, streamed into the archive
+            m_file * file = skip ? NULL : _m_tar_entry(&pkg.root, name, false);
+            uint64_t hash = M_HASH_SEED;
+            success = _m_tar_read(tar, size, NULL, file ? out : NULL, file ? &hash : NULL) && _m_tar_read(tar, padding, NULL, NULL, NULL);
+            if(file) {
+                file->size = size;
+                file->offset = pkg.data_size;
+                if(count == capacity) {
+                    capacity = capacity ? capacity * 2 : 256;
+                    files = (_m_tar_file *)realloc(files, sizeof(_m_tar_file) * capacity);
+                }
+                files[count].offset = file->offset;
+                files[count].hash = hash;
+                count++;
+                pkg.data_size += size;
+            }
+        }
+        else {
+            if(skip) {
+                // Already reported
+            }
+            else if(type == '5')
+                _m_tar_entry(&pkg.root, name, true);
+            else if(type != 'g')
+                fprintf(stderr, "Skipping tar entry that isn't a file or folder: %s\n", name);
+            success = _m_tar_read(tar, size + padding, NULL, NULL, NULL);
+        }
+        if(!success)
+            fprintf(stderr, ferror(out) ? "Failed to write archive\n" : "Failed to import tar: unexpected end of stream\n");
+    }
+    free(long_name);
+
+    if(success) {
+        // Build the table of contents and fill in the file hashes by payload offset
+        archive toc = _archive_package_v2(pkg, true, NULL, 0, NULL);
+        m_archive_header * toc_header = (m_archive_header *)toc.data;
+        uint64_t toc_offset = m_le64(toc_header->toc_offset), toc_size = m_le64(toc_header->toc_size);
+        m_folder_record * folder_records = (m_folder_record *)(toc.data + toc_offset);
+        m_file_record * file_records = (m_file_record *)(folder_records + m_le32(toc_header->folder_count));
+        qsort(files, count, sizeof(_m_tar_file), _m_compare_tar_files);
+        for(uint32_t i = 0; i < m_le32(toc_header->file_count); ++i) {
+            _m_tar_file key = {}, * found;
+            key.offset = m_le64(file_records[i].offset);
+            found = (_m_tar_file *)bsearch(&key, files, count, sizeof(_m_tar_file), _m_compare_tar_files);
+            if(found) file_records[i].hash = m_le64(found->hash);
+        }
+
+        // Table of contents after the data, then the real header
+        uint64_t data_end = data_offset + pkg.data_size;
+        uint64_t new_toc_offset = (data_end + 7) & ~(uint64_t)7;
+        uint8_t zeros[8] = {};
+        imported = m_le32(toc_header->file_count);
+        header = *toc_header;
+        header.toc_offset = m_le64(new_toc_offset);
+        header.data_offset = m_le64(data_offset);
+        success = fwrite(zeros, 1, new_toc_offset - data_end, out) == new_toc_offset - data_end
+            && fwrite(toc.data + toc_offset, 1, toc_size, out) == toc_size
+            && fseek(out, 0, SEEK_SET) == 0
+            && fwrite(&header, sizeof(header), 1, out) == 1;
+        free(toc.data);
+    }
+    success &= fclose(out) == 0;
+    if(!success) _m_remove_output(archive_filename);
+    if(file_count) *file_count = imported;
+
+    free(files);
+    _free_folder(pkg.root);
+    return success;
+}
+
+// - Shared mapping functions -
+#ifdef MUCKPAK_MMAP
+
+// Mapped packages share one copy of the archive and its index between every process on a host.
+// Version 2 archives are their own index. Version 1 archives get a version 2 index file built by
+// the first process that maps them (<archive>.idx), later processes attach to it read only.
+
+#define M_INDEX_VERSION 1
+
+// Index file header, identifies the exact archive the index was built from
+typedef struct m_index_header {
+    char id[4];                 // "MIDX"
+    uint32_t version;           // M_INDEX_VERSION
+    uint32_t format;            // Archive format version (M_VERSION_CURRENT when built)
+    uint32_t reserved;
+    uint64_t archive_size;      // Identity of the indexed archive
+    uint64_t archive_mtime;
+    uint64_t archive_inode;
+    uint64_t archive_device;
+    uint64_t data_offset;       // Offset of the file data in the archive
+    uint64_t data_size;
+} m_index_header;
+
+// Archive mapped shared and read only
+typedef struct m_mapped {
+    m_view view;                // In place view of the archive
+    uint8_t * map;              // Mapped archive
+    unsigned long map_size;
+    uint8_t * index;            // Mapped index file (version 1 archives only)
+    unsigned long index_size;
+    bool index_in_memory;       // Set when the index file couldn't be written and index was built in memory
+
+    // Every volume of a multi-volume archive, the first is map
+    uint32_t volume_count;
+    uint8_t ** volume_maps;
+    unsigned long * volume_sizes;
+    const uint8_t ** volume_data; // Data section of each volume
+    uint64_t * data_sizes;        // Data section size of each volume
+} m_mapped;
+
+// Map a whole file shared and read only
+uint8_t * _m_map_file(const char * filename, unsigned long * size, struct stat * st) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) return NULL;
+    if(fstat(fd, st) != 0 || st->st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void * map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return NULL;
+    *size = st->st_size;
+    return (uint8_t *)map;
+}
+
+// Fill in the identity of an archive for its index
+m_index_header _m_index_identity(struct stat * st) {
+    m_index_header header = {};
+    memcpy(header.id, "MIDX", 4);
+    header.version = m_le32(M_INDEX_VERSION);
+    header.format = m_le32(M_VERSION_2);
+    header.archive_size = m_le64(st->st_size);
+    header.archive_mtime = m_le64(_m_stat_mtime(st));
+    header.archive_inode = m_le64(st->st_ino);
+    header.archive_device = m_le64(st->st_dev);
+    return header;
+}
+
+// Check an index file belongs to an archive
+bool _m_index_matches(const uint8_t * index, unsigned long index_size, m_index_header identity) {
+    if(index_size < sizeof(m_index_header)) return false;
+    const m_index_header * header = (const m_index_header *)index;
+    return memcmp(header->id, identity.id, 4) == 0 && header->version == identity.version && header->format == identity.format
+        && header->archive_size == identity.archive_size && header->archive_mtime == identity.archive_mtime
+        && header->archive_inode == identity.archive_inode && header->archive_device == identity.archive_device;
+}
+
+// Build the index of a mapped version 1 archive in memory (must be freed), null if the archive is invalid
+uint8_t * _m_build_index(const uint8_t * map, unsigned long map_size, m_index_header identity, unsigned long * index_size) {
+    // Parse the version 1 structure straight from the mapping, without copying the file data
+    package pkg = {};
+    memcpy(pkg.id, map, 4);
+    memcpy(&pkg.struct_size, map + 4, 8);
+    memcpy(&pkg.data_size, map + 12, 8);
+    if(pkg.struct_size > map_size || pkg.data_size > map_size - pkg.struct_size) return NULL;
+    uint8_t * structure = (uint8_t *)map + M_PACKAGE_HEAD_SIZE;
+    pkg.root = _unarchive_folder(&structure);
+    archive toc = _archive_package_v2(pkg, true, NULL, 0, NULL);
+    _free_folder(pkg.root);
+
+    identity.data_offset = m_le64(pkg.struct_size);
+    identity.data_size = m_le64(pkg.data_size);
+    *index_size = sizeof(identity) + toc.size;
+    uint8_t * index = (uint8_t *)malloc(*index_size);
+    memcpy(index, &identity, sizeof(identity));
+    memcpy(index + sizeof(identity), toc.data, toc.size);
+    free(toc.data);
+    return index;
+}
+
+// Write an index file, written to a temporary file then renamed into place
+bool _m_write_index(const char * index_filename, const uint8_t * index, unsigned long index_size) {
+    // Write it next to the final name so the rename is atomic
+    char temp_filename[1024];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.%d.tmp", index_filename, (int)getpid());
+    FILE * f = fopen(temp_filename, "wb");
+    if(!f) return false;
+    bool success = fwrite(index, 1, index_size, f) == index_size;
+    success &= fclose(f) == 0;
+    if(success) success = rename(temp_filename, index_filename) == 0;
+    if(!success) remove(temp_filename);
+    return success;
+}
+
+// Open the view of a version 1 archive through its index
+bool _m_attach_index(m_mapped * mapped) {
+    const m_index_header * header = (const m_index_header *)mapped->index;
+    uint64_t data_offset = m_le64(header->data_offset);
+    uint64_t data_size = m_le64(header->data_size);
+    if(!_m_open_view_toc(mapped->index + sizeof(m_index_header), mapped->index_size - sizeof(m_index_header), &mapped->view)
+        || data_offset > mapped->map_size || data_size > mapped->map_size - data_offset)
+        return false;
+    mapped->view.data = mapped->map + data_offset;
+    return true;
+}
+
+// Map the volumes of a multi-volume archive after the first
+bool _m_map_volumes(const char * filename, m_mapped * mapped) {
+    uint32_t count = view_volume_count(mapped->view);
+    mapped->volume_count = count;
+    mapped->volume_maps = (uint8_t **)calloc(count, sizeof(uint8_t *));
+    mapped->volume_sizes = (unsigned long *)calloc(count, sizeof(unsigned long));
+    mapped->volume_data = (const uint8_t **)calloc(count, sizeof(const uint8_t *));
+    mapped->data_sizes = (uint64_t *)calloc(count, sizeof(uint64_t));
+    mapped->volume_maps[0] = mapped->map;
+    mapped->volume_sizes[0] = mapped->map_size;
+    mapped->volume_data[0] = mapped->view.data;
+    mapped->data_sizes[0] = m_le64(mapped->view.header->data_size);
+    for(uint32_t i = 1; i < count; ++i) {
+        char volume_filename[1024];
+        struct stat st;
+        archive_volume_filename(volume_filename, sizeof(volume_filename), filename, i);
+        mapped->volume_maps[i] = _m_map_file(volume_filename, &mapped->volume_sizes[i], &st);
+        if(mapped->volume_maps[i])
+            mapped->volume_data[i] = volume_data(mapped->view, mapped->volume_maps[i], mapped->volume_sizes[i], i);
+        if(!mapped->volume_data[i]) {
+            fprintf(stderr, "Failed to map volume: %s\n", volume_filename);
+            return false;
+        }
+        mapped->data_sizes[i] = m_le64(((const m_archive_header *)mapped->volume_maps[i])->data_size);
+    }
+    mapped->view.volumes = mapped->volume_data;
+    mapped->view.volume_sizes = mapped->data_sizes;
+    return true;
+}
+
+// Unmap a mapped package
+void unmap_package(m_mapped mapped) {
+    if(mapped.map) munmap(mapped.map, mapped.map_size);
+    if(mapped.index && mapped.index_in_memory) free(mapped.index);
+    else if(mapped.index) munmap(mapped.index, mapped.index_size);
+    for(uint32_t i = 1; i < mapped.volume_count; ++i)
+        if(mapped.volume_maps[i]) munmap(mapped.volume_maps[i], mapped.volume_sizes[i]);
+    free(mapped.volume_maps);
+    free(mapped.volume_sizes);
+    free(mapped.volume_data);
+    free(mapped.data_sizes);
+}
+
+// Map an archive shared between processes, returns false if it couldn't be mapped
+// For multi-volume archives this is the first volume, the rest are mapped with it
+bool map_package(const char * filename, m_mapped * mapped) {
+    m_mapped empty = {};
+    *mapped = empty;
+    struct stat st;
+    mapped->map = _m_map_file(filename, &mapped->map_size, &st);
+    if(!mapped->map) {
+        perror("Failed to map archive");
+        return false;
+    }
+
+    // Version 2 archives are queried in place
+    if(open_view(mapped->map, mapped->map_size, &mapped->view)) {
+        if(view_volume_count(mapped->view) == 1 || _m_map_volumes(filename, mapped))
+            return true;
+        unmap_package(*mapped);
+        *mapped = empty;
+        return false;
+    }
+
+    // Version 1 archives use an index file, rebuilt if it is missing or stale
+    // If it can't be written (a read only location) the index is kept in this process instead
+    m_index_header identity = _m_index_identity(&st);
+    char index_filename[1024];
+    snprintf(index_filename, sizeof(index_filename), "%s.idx", filename);
+    for(int attempt = 0; attempt < 2; ++attempt) {
+        struct stat index_st;
+        mapped->index = _m_map_file(index_filename, &mapped->index_size, &index_st);
+        if(mapped->index && _m_index_matches(mapped->index, mapped->index_size, identity) && _m_attach_index(mapped))
+            return true;
+        if(mapped->index) munmap(mapped->index, mapped->index_size);
+        mapped->index = NULL;
+        if(attempt == 1) break;
+
+        unsigned long index_size;
+        uint8_t * index = _m_build_index(mapped->map, mapped->map_size, identity, &index_size);
+        if(!index) break;
+        if(_m_write_index(index_filename, index, index_size)) {
+            free(index);
+            continue;
+        }
+        mapped->index = index;
+        mapped->index_size = index_size;
+        mapped->index_in_memory = true;
+        if(_m_attach_index(mapped)) return true;
+        free(index);
+        mapped->index = NULL;
+        mapped->index_in_memory = false;
+        break;
+    }
+
+    fprintf(stderr, "Failed to index archive: %s\n", filename);
+    munmap(mapped->map, mapped->map_size);
+    mapped->map = NULL;
+    return false;
+}
+
+// - Prefetch functions -
+
+// Prefetching warms the payloads of a folder (or a single file) on a background thread, so the
+// first access on the hot path doesn't stall. Payload ranges are coalesced, advised with
+// MADV_WILLNEED and then touched page by page so they are resident when the prefetch completes.
+
+#define M_PREFETCH_GAP 65536    // Largest gap between payloads read through to join their ranges
+
+// Byte range of payloads, relative to the file data of a volume
+typedef struct m_range {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t volume;
+} m_range;
+
+// Called once a prefetch completes, with the number of payload bytes it warmed
+typedef void (*m_prefetch_callback)(const char * path, uint64_t bytes, void * user);
+
+// Running prefetch
+typedef struct m_prefetch {
+    pthread_t thread;
+    bool threaded;              // Set when the thread was created, otherwise the prefetch ran on the caller
+    pthread_mutex_t lock;       // Guards done and bytes
+    bool done;                  // Set when the prefetch completed
+    uint64_t bytes;             // Bytes warmed
+
+    const uint8_t * data;       // File data the ranges are in
+    const uint8_t * const * volumes;    // File data of each volume (multi-volume archives only)
+    m_range * ranges;
+    unsigned long range_count, range_capacity;
+
+    char * path;
+    m_prefetch_callback callback;
+    void * user;
+} m_prefetch;
+
+// Add a payload range
+void _m_add_range(m_prefetch * prefetch, uint32_t volume, uint64_t offset, uint64_t size) {
+    if(size == 0) return;
+    if(prefetch->range_count == prefetch->range_capacity) {
+        prefetch->range_capacity = prefetch->range_capacity ? prefetch->range_capacity * 2 : 64;
+        prefetch->ranges = (m_range *)realloc(prefetch->ranges, sizeof(m_range) * prefetch->range_capacity);
+    }
+    prefetch->ranges[prefetch->range_count].offset = offset;
+    prefetch->ranges[prefetch->range_count].size = size;
+    prefetch->ranges[prefetch->range_count].volume = volume;
+    prefetch->range_count++;
+}
+
+int _m_compare_ranges(const void * a, const void * b) {
+    const m_range * range_a = (const m_range *)a, * range_b = (const m_range *)b;
+    if(range_a->volume != range_b->volume) return range_a->volume < range_b->volume ? -1 : 1;
+    return (range_a->offset > range_b->offset) - (range_a->offset < range_b->offset);
+}
+
+// Sort ranges and join the ones in the same volume that overlap or sit close together
+void _m_coalesce_ranges(m_prefetch * prefetch) {
+    if(prefetch->range_count == 0) return;
+    qsort(prefetch->ranges, prefetch->range_count, sizeof(m_range), _m_compare_ranges);
+    unsigned long count = 1;
+    for(unsigned long i = 1; i < prefetch->range_count; ++i) {
+        m_range * last = &prefetch->ranges[count - 1];
+        m_range range = prefetch->ranges[i];
+        if(range.volume == last->volume && range.offset <= last->offset + last->size + M_PREFETCH_GAP) {
+            if(range.offset + range.size > last->offset + last->size)
+                last->size = range.offset + range.size - last->offset;
+        }
+        else prefetch->ranges[count++] = range;
+    }
+    prefetch->range_count = count;
+}
+
+// Collect the payload ranges of a folder
+void _m_folder_ranges(m_prefetch * prefetch, m_folder * folder) {
+    load_folder(folder);
+    for(unsigned int i = 0; i < folder->file_count; ++i)
+        _m_add_range(prefetch, 0, folder->files[i].offset, folder->files[i].size);
+    for(unsigned int i = 0; i < folder->folder_count; ++i)
+        _m_folder_ranges(prefetch, &folder->subfolders[i]);
+}
+
+// Collect the payload ranges of a view folder
+void _m_view_folder_ranges(m_prefetch * prefetch, m_view view, const m_folder_record * folder) {
+    if(!_m_view_children_valid(view, folder)) return;
+    const m_file_record * files = view.files + m_le32(folder->first_file);
+    for(uint32_t i = 0; i < m_le32(folder->file_count); ++i)
+        if(_m_view_payload_valid(view, &files[i]))
+            _m_add_range(prefetch, m_le32(files[i].volume), m_le64(files[i].offset), m_le64(files[i].size));
+    const m_folder_record * folders = view.folders + m_le32(folder->first_folder);
+    for(uint32_t i = 0; i < m_le32(folder->folder_count); ++i)
+        _m_view_folder_ranges(prefetch, view, &folders[i]);
+}
+
+// Warm every range, runs on the prefetch thread
+void * _m_prefetch_run(void * argument) {
+    m_prefetch * prefetch = (m_prefetch *)argument;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+
+    // Let the kernel start reading everything at once, across every volume
+    for(unsigned long i = 0; i < prefetch->range_count; ++i) {
+        const uint8_t * data = prefetch->volumes ? prefetch->volumes[prefetch->ranges[i].volume] : prefetch->data;
+        uintptr_t start = (uintptr_t)(data + prefetch->ranges[i].offset);
+        uintptr_t end = start + prefetch->ranges[i].size;
+        start &= ~(page - 1);
+        madvise((void *)start, end - start, MADV_WILLNEED);
+    }
+
+    // Then make sure each page is resident
+    uint64_t bytes = 0;
+    for(unsigned long i = 0; i < prefetch->range_count; ++i) {
+        const volatile uint8_t * data = (prefetch->volumes ? prefetch->volumes[prefetch->ranges[i].volume] : prefetch->data) + prefetch->ranges[i].offset;
+        uint64_t size = prefetch->ranges[i].size;
+        for(uint64_t offset = 0; offset < size; offset += page)
+            (void)data[offset];
+        (void)data[size - 1];
+        bytes += size;
+    }
+
+    pthread_mutex_lock(&prefetch->lock);
+    prefetch->bytes = bytes;
+    prefetch->done = true;
+    pthread_mutex_unlock(&prefetch->lock);
+    if(prefetch->callback) prefetch->callback(prefetch->path, bytes, prefetch->user);
+    return NULL;
+}
+
+// Start the prefetch thread, returns null if the path wasn't found
+m_prefetch * _m_prefetch_start(m_prefetch * prefetch, bool found) {
+    if(!found) {
+        fprintf(stderr, "Failed to find prefetch path: %s\n", prefetch->path);
+        pthread_mutex_destroy(&prefetch->lock);
+        free(prefetch->ranges);
+        free(prefetch->path);
+        free(prefetch);
+        return NULL;
+    }
+    _m_coalesce_ranges(prefetch);
+    prefetch->threaded = pthread_create(&prefetch->thread, NULL, _m_prefetch_run, prefetch) == 0;
+    if(!prefetch->threaded) {
+        // Fall back to warming on the calling thread
+        _m_prefetch_run(prefetch);
+    }
+    return prefetch;
+}
+
+m_prefetch * _m_new_prefetch(const uint8_t * data, const char * path, m_prefetch_callback callback, void * user) {
+    m_prefetch * prefetch = (m_prefetch *)calloc(1, sizeof(m_prefetch));
+    pthread_mutex_init(&prefetch->lock, NULL);
+    prefetch->data = data;
+    prefetch->path = strdup(path);
+    prefetch->callback = callback;
+    prefetch->user = user;
+    return prefetch;
+}
+
+// Start warming a folder or file of a package in the background (callback may be null)
+// Returns null if the path wasn't found, otherwise wait for the prefetch with prefetch_wait()
+m_prefetch * prefetch_folder(package pkg, const char * path, m_prefetch_callback callback, void * user) {
+    m_prefetch * prefetch = _m_new_prefetch(pkg.data, path, callback, user);
+
+    // Find the folder or file
+    m_folder * folder = &pkg.root;
+    m_file * file = NULL;
+    bool found = true;
+    char * path_copy = strdup(path);
+    for(char * token = strtok(path_copy, "/"); token && found; token = strtok(NULL, "/")) {
+        m_entry entry = {};
+        if(folder) entry = get_entry_in_folder(*folder, token);
+        found = entry.exists;
+        folder = entry.is_file ? NULL : entry.folder;
+        file = entry.is_file ? entry.file : NULL;
+    }
+    free(path_copy);
+
+    if(found && file)
+        _m_add_range(prefetch, 0, file->offset, file->size);
+    else if(found)
+        _m_folder_ranges(prefetch, folder);
+    return _m_prefetch_start(prefetch, found);
+}
+
+// Start warming a folder or file of a mapped package in the background (callback may be null)
+m_prefetch * prefetch_folder(m_mapped * mapped, const char * path, m_prefetch_callback callback, void * user) {
+    m_prefetch * prefetch = _m_new_prefetch(mapped->view.data, path, callback, user);
+    prefetch->volumes = mapped->view.volumes;
+    const m_file_record * file = path[0] ? view_get_file(mapped->view, path) : NULL;
+    const m_folder_record * folder = file ? NULL : view_get_folder(mapped->view, path);
+    if(file && _m_view_payload_valid(mapped->view, file))
+        _m_add_range(prefetch, m_le32(file->volume), m_le64(file->offset), m_le64(file->size));
+    else if(folder)
+        _m_view_folder_ranges(prefetch, mapped->view, folder);
+    return _m_prefetch_start(prefetch, file || folder);
+}
+
+// Check if a prefetch completed
+bool prefetch_done(m_prefetch * prefetch) {
+    pthread_mutex_lock(&prefetch->lock);
+    bool done = prefetch->done;
+    pthread_mutex_unlock(&prefetch->lock);
+    return done;
+}
+
+// Wait for a prefetch to complete and free it, returns the bytes it warmed
+uint64_t prefetch_wait(m_prefetch * prefetch) {
+    if(prefetch->threaded)
+        pthread_join(prefetch->thread, NULL);
+    uint64_t bytes = prefetch->bytes;
+    pthread_mutex_destroy(&prefetch->lock);
+    free(prefetch->ranges);
+    free(prefetch->path);
+    free(prefetch);
+    return bytes;
+}
+
+// - Residency functions -
+
+// A residency manager keeps the resident payloads of a long running mapped package under a byte
+// budget. Files read through it are kept in a list from most to least recently accessed and their
+// pages are counted, and once the budget is exceeded the coldest payloads are released from the
+// end of the list with MADV_COLD/MADV_DONTNEED
+// until the resident pages drop back under M_RESIDENCY_LOW of the budget. That only drops them from
+// this process, released payloads fault back in from the page cache (or the archive) the next time
+// they are read. Setting pageout also evicts them from the page cache with MADV_PAGEOUT, which
+// affects every process sharing the pages.
+
+#define M_RESIDENCY_ROOT 0xFFFFFFFFu    // Top level index of files in the root folder
+#define M_RESIDENCY_LOW 0.875           // Fraction of the budget to release down to
+
+// Called for each top level folder of a residency report ("" for files in the root folder)
+typedef void (*m_residency_callback)(const char * folder, uint64_t payload_bytes, uint64_t resident_bytes, void * user);
+
+// Residency manager of a mapped package
+typedef struct m_residency {
+    m_mapped * mapped;
+    uint64_t budget;            // Resident bytes allowed, 0 for no limit
+    uint64_t resident;          // Bytes of the pages read and not released since
+    uint64_t released;          // Bytes of the pages released in total
+    bool pageout;               // Evict released pages from the page cache as well (off by default)
+
+    uint32_t * newer;           // Access order links of each file record, as index + 1 (0 for none)
+    uint32_t * older;
+    uint32_t newest, oldest;    // Most and least recently accessed resident file records, as index + 1
+    uint32_t * top_level;       // Top level folder of each file record
+    uint8_t ** pages;           // Resident flag of each page of each volume
+    uint64_t page_size;
+    pthread_mutex_t lock;
+} m_residency;
+
+// Record the top level folder of every file in a view folder
+void _m_residency_assign(m_residency * residency, const m_folder_record * folder, uint32_t top) {
+    m_view view = residency->mapped->view;
+    if(!_m_view_children_valid(view, folder)) return;
+    uint32_t first_file = m_le32(folder->first_file);
+    for(uint32_t i = 0; i < m_le32(folder->file_count); ++i)
+        residency->top_level[first_file + i] = top;
+    const m_folder_record * folders = view.folders + m_le32(folder->first_folder);
+    for(uint32_t i = 0; i < m_le32(folder->folder_count); ++i)
+        _m_residency_assign(residency, &folders[i], top);
+}
+
+// Start managing the residency of a mapped package, budget is in bytes of mapped pages (0 for no limit)
+void manage_residency(m_mapped * mapped, uint64_t budget, m_residency * residency) {
+    m_residency empty = {};
+    *residency = empty;
+    residency->mapped = mapped;
+    residency->budget = budget;
+    uint32_t file_count = m_le32(mapped->view.header->file_count);
+    residency->newer = (uint32_t *)calloc(file_count + 1, sizeof(uint32_t));
+    residency->older = (uint32_t *)calloc(file_count + 1, sizeof(uint32_t));
+    residency->top_level = (uint32_t *)calloc(file_count + 1, sizeof(uint32_t));
+    residency->page_size = sysconf(_SC_PAGESIZE);
+    uint32_t volume_count = mapped->volume_count ? mapped->volume_count : 1;
+    residency->pages = (uint8_t **)malloc(sizeof(uint8_t *) * volume_count);
+    for(uint32_t i = 0; i < volume_count; ++i) {
+        unsigned long map_size = mapped->volume_count ? mapped->volume_sizes[i] : mapped->map_size;
+        residency->pages[i] = (uint8_t *)calloc((map_size + residency->page_size - 1) / residency->page_size + 1, 1);
+    }
+    pthread_mutex_init(&residency->lock, NULL);
+
+    const m_folder_record * root = view_root(mapped->view);
+    _m_residency_assign(residency, root, M_RESIDENCY_ROOT);
+    if(!_m_view_children_valid(mapped->view, root)) return;
+    const m_folder_record * folders = mapped->view.folders + m_le32(root->first_folder);
+    for(uint32_t i = 0; i < m_le32(root->folder_count); ++i)
+        _m_residency_assign(residency, &folders[i], m_le32(root->first_folder) + i);
+}
+
+// Stop managing residency, payloads are left as they are
+void free_residency(m_residency residency) {
+    uint32_t volume_count = residency.mapped->volume_count ? residency.mapped->volume_count : 1;
+    for(uint32_t i = 0; i < volume_count; ++i)
+        free(residency.pages[i]);
+    free(residency.pages);
+    free(residency.newer);
+    free(residency.older);
+    free(residency.top_level);
+    pthread_mutex_destroy(&residency.lock);
+}
+
+// Pages of a file record in its volume's map, from first up to (not including) end
+void _m_residency_pages(m_residency * residency, const m_file_record * file, uint32_t * volume, uint64_t * first, uint64_t * end) {
+    m_mapped * mapped = residency->mapped;
+    *volume = mapped->volume_count ? m_le32(file->volume) : 0;
+    const uint8_t * map = mapped->volume_count ? mapped->volume_maps[*volume] : mapped->map;
+    const uint8_t * data = mapped->volume_count ? mapped->volume_data[*volume] : mapped->view.data;
+    uint64_t start = (data - map) + m_le64(file->offset);
+    uint64_t size = m_le64(file->size);
+    *first = start / residency->page_size;
+    *end = size ? (start + size + residency->page_size - 1) / residency->page_size : *first;
+}
+
+// Release a file's pages from this process (and the page cache with pageout), returns the bytes of
+// the pages that were counted as resident. Whole pages are released, so neighbouring payloads may
+// have to fault back in
+uint64_t _m_release_file(m_residency * residency, const m_file_record * file) {
+    uint32_t volume;
+    uint64_t first, end;
+    _m_residency_pages(residency, file, &volume, &first, &end);
+    if(first == end) return 0;
+
+    uint8_t * map = residency->mapped->volume_count ? residency->mapped->volume_maps[volume] : residency->mapped->map;
+    void * start = map + first * residency->page_size;
+    size_t length = (end - first) * residency->page_size;
+    #ifdef MADV_PAGEOUT
+    if(residency->pageout) madvise(start, length, MADV_PAGEOUT);
+    #endif
+    #ifdef MADV_COLD
+    madvise(start, length, MADV_COLD);
+    #endif
+    madvise(start, length, MADV_DONTNEED);
+
+    uint64_t released = 0;
+    for(uint64_t page = first; page < end; ++page) {
+        if(!residency->pages[volume][page]) continue;
+        residency->pages[volume][page] = 0;
+        released += residency->page_size;
+    }
+    return released;
+}
+
+// Take a file record out of the access order, if it is in it
+void _m_residency_unlink(m_residency * residency, uint32_t index) {
+    uint32_t newer = residency->newer[index], older = residency->older[index];
+    if(!newer && residency->newest != index + 1) return;
+    if(newer) residency->older[newer - 1] = older;
+    else residency->newest = older;
+    if(older) residency->newer[older - 1] = newer;
+    else residency->oldest = newer;
+    residency->newer[index] = residency->older[index] = 0;
+}
+
+// Move a file record to the front of the access order
+void _m_residency_touch(m_residency * residency, uint32_t index) {
+    _m_residency_unlink(residency, index);
+    residency->older[index] = residency->newest;
+    if(residency->newest) residency->newer[residency->newest - 1] = index + 1;
+    else residency->oldest = index + 1;
+    residency->newest = index + 1;
+}
+
+// Release the coldest payloads until under the budget, call with the lock held
+uint64_t _m_enforce_residency(m_residency * residency) {
+    if(residency->budget == 0 || residency->resident <= residency->budget) return 0;
+    m_view view = residency->mapped->view;
+
+    // Release from the least recently accessed end of the list
+    uint64_t target = (uint64_t)(residency->budget * M_RESIDENCY_LOW);
+    uint64_t released = 0;
+    while(residency->oldest && residency->resident > target) {
+        uint32_t index = residency->oldest - 1;
+        _m_residency_unlink(residency, index);
+        uint64_t size = _m_release_file(residency, &view.files[index]);
+        residency->resident -= size;
+        released += size;
+    }
+    residency->released += released;
+    return released;
+}
+
+// Release the coldest payloads until under the budget, returns the bytes released
+uint64_t enforce_residency(m_residency * residency) {
+    pthread_mutex_lock(&residency->lock);
+    uint64_t released = _m_enforce_residency(residency);
+    pthread_mutex_unlock(&residency->lock);
+    return released;
+}
+
+// Change the budget of a residency manager, releasing payloads if it is now exceeded
+uint64_t set_residency_budget(m_residency * residency, uint64_t budget) {
+    pthread_mutex_lock(&residency->lock);
+    residency->budget = budget;
+    uint64_t released = _m_enforce_residency(residency);
+    pthread_mutex_unlock(&residency->lock);
+    return released;
+}
+
+// Mark a file record as accessed and return its payload
+const uint8_t * residency_access(m_residency * residency, const m_file_record * file) {
+    m_view view = residency->mapped->view;
+    if(!_m_view_payload_valid(view, file)) return NULL;
+    uint32_t index = (uint32_t)(file - view.files);
+    uint32_t volume;
+    uint64_t first, end;
+    _m_residency_pages(residency, file, &volume, &first, &end);
+    pthread_mutex_lock(&residency->lock);
+
+    // Count its pages, some may have been released along with a neighbour
+    for(uint64_t page = first; page < end; ++page) {
+        if(residency->pages[volume][page]) continue;
+        residency->pages[volume][page] = 1;
+        residency->resident += residency->page_size;
+    }
+    _m_residency_touch(residency, index);
+    _m_enforce_residency(residency);
+    pthread_mutex_unlock(&residency->lock);
+    return view_file_binary(view, file);
+}
+
+// Get the payload of a file through a residency manager, returns null if it wasn't found
+const uint8_t * residency_get_file(m_residency * residency, const char * path, uint64_t * size) {
+    const m_file_record * file = view_get_file(residency->mapped->view, path);
+    if(!file) {
+        fprintf(stderr, "Failed to find file: %s\n", path);
+        return NULL;
+    }
+    if(size) *size = view_file_size(file);
+    return residency_access(residency, file);
+}
+
+// Report payload and actually resident bytes per top level folder, using mincore
+void residency_report(m_residency * residency, m_residency_callback callback, void * user) {
+    m_mapped * mapped = residency->mapped;
+    m_view view = mapped->view;
+    uint32_t file_count = m_le32(view.header->file_count);
+    const m_folder_record * root = view_root(view);
+    uint32_t first_folder = m_le32(root->first_folder);
+    uint32_t folder_count = _m_view_children_valid(view, root) ? m_le32(root->folder_count) : 0;
+
+    // Residency of every page of each volume
+    uint32_t volume_count = mapped->volume_count ? mapped->volume_count : 1;
+    uint8_t ** maps = mapped->volume_count ? mapped->volume_maps : &mapped->map;
+    unsigned long * map_sizes = mapped->volume_count ? mapped->volume_sizes : &mapped->map_size;
+    const uint8_t * const * volumes = mapped->volume_count ? mapped->volume_data : &view.data;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    unsigned char ** pages = (unsigned char **)malloc(sizeof(unsigned char *) * volume_count);
+    for(uint32_t i = 0; i < volume_count; ++i) {
+        pages[i] = (unsigned char *)calloc((map_sizes[i] + page - 1) / page, 1);
+        if(mincore(maps[i], map_sizes[i], pages[i]) != 0)
+            perror("Failed to query residency");
+    }
+
+    // Slot folder_count holds the files of the root folder
+    uint64_t * payload = (uint64_t *)calloc(folder_count + 1, sizeof(uint64_t));
+    uint64_t * resident = (uint64_t *)calloc(folder_count + 1, sizeof(uint64_t));
+    for(uint32_t i = 0; i < file_count; ++i) {
+        // Files outside the tree or with malformed records aren't counted
+        uint32_t top = residency->top_level[i];
+        uint32_t slot = top == M_RESIDENCY_ROOT ? folder_count : top - first_folder;
+        if((top != M_RESIDENCY_ROOT && (top < first_folder || slot >= folder_count)) || !_m_view_payload_valid(view, &view.files[i]))
+            continue;
+        uint32_t volume = mapped->volume_count ? m_le32(view.files[i].volume) : 0;
+        uint64_t start = (volumes[volume] - maps[volume]) + m_le64(view.files[i].offset);
+        uint64_t end = start + m_le64(view.files[i].size);
+        payload[slot] += end - start;
+
+        // Count the bytes of the payload that sit in resident pages
+        for(uint64_t at = start; at < end;) {
+            uint64_t page_end = (at / page + 1) * page;
+            if(page_end > end) page_end = end;
+            if(pages[volume][at / page] & 1) resident[slot] += page_end - at;
+            at = page_end;
+        }
+    }
+
+    for(uint32_t i = 0; i < folder_count; ++i) {
+        const char * name = view_folder_name(view, &view.folders[first_folder + i]);
+        callback(name ? name : "", payload[i], resident[i], user);
+    }
+    if(m_le32(root->file_count))
+        callback("", payload[folder_count], resident[folder_count], user);
+
+    for(uint32_t i = 0; i < volume_count; ++i)
+        free(pages[i]);
+    free(pages);
+    free(payload);
+    free(resident);
+}
+
+#endif
+
+// - Live reload functions -
+#ifdef MUCKPAK_DEV_RELOAD
+
+// A development package is loaded from a source folder like load_package_folder, then kept in sync
+// with it through inotify. Lookups use the usual functions on its pkg member. File and data
+// pointers from the package are invalidated by poll_dev_package when anything changed.
+
+#define M_DEV_COMPACT_SIZE (1 << 20)    // Dead data allowed before the data is compacted
+
+// Called for every file path (relative to the root) that changed, removed is true if it no longer exists
+typedef void (*m_reload_callback)(const char * path, bool removed, void * user);
+
+// Watched folder
+typedef struct _m_watch {
+    int wd;
+    char * path;    // Folder path relative to the root ("" for the root)
+} _m_watch;
+
+typedef struct _m_subscriber {
+    m_reload_callback callback;
+    void * user;
+} _m_subscriber;
+
+// Package mounted over a source folder
+typedef struct m_dev_package {
+    package pkg;                    // Live package
+    char * source;                  // Source folder
+    int fd;                         // inotify descriptor
+
+    _m_watch * watches;
+    unsigned long watch_count, watch_capacity;
+
+    _m_subscriber * subscribers;
+    unsigned long subscriber_count;
+
+    unsigned long live_size;        // Bytes of pkg.data still used by files
+} m_dev_package;
+
+// Join a relative folder path and a name, returns false (with a warning) if it doesn't fit
+bool _m_dev_join(char * out, size_t size, const char * folder, const char * name) {
+    int length = folder[0] ? snprintf(out, size, "%s/%s", folder, name) : snprintf(out, size, "%s", name);
+    if(length < 0 || (size_t)length >= size) {
+        fprintf(stderr, "Skipping path longer than %d bytes: %s/%s\n", (int)size - 1, folder, name);
+        return false;
+    }
+    return true;
+}
+
+// Get a loaded folder by relative path
+m_folder * _m_dev_folder(m_dev_package * dev, const char * path) {
+    m_folder * folder = &dev->pkg.root;
+    char * path_copy = strdup(path);
+    for(char * token = strtok(path_copy, "/"); token && folder; token = strtok(NULL, "/")) {
+        m_entry entry = get_entry_in_folder(*folder, token);
+        folder = entry.exists && !entry.is_file ? entry.folder : NULL;
+    }
+    free(path_copy);
+    return folder;
+}
+
+// Tell every subscriber a path changed
+void _m_dev_notify(m_dev_package * dev, const char * path, bool removed) {
+    for(unsigned long i = 0; i < dev->subscriber_count; ++i)
+        dev->subscribers[i].callback(path, removed, dev->subscribers[i].user);
+}
+
+// Notify every file in a folder, returns the number of files
+int _m_dev_notify_tree(m_dev_package * dev, m_folder * folder, const char * path, bool removed) {
+    int count = 0;
+    char child[1024];
+    for(unsigned int i = 0; i < folder->file_count; ++i) {
+        if(!_m_dev_join(child, sizeof(child), path, folder->files[i].name)) continue;
+        _m_dev_notify(dev, child, removed);
+        count++;
+    }
+    for(unsigned int i = 0; i < folder->folder_count; ++i) {
+        if(!_m_dev_join(child, sizeof(child), path, folder->subfolders[i].name)) continue;
+        count += _m_dev_notify_tree(dev, &folder->subfolders[i], child, removed);
+    }
+    return count;
+}
+
+// Total size of the files in a folder
+unsigned long _m_dev_tree_size(m_folder * folder) {
+    unsigned long size = 0;
+    for(unsigned int i = 0; i < folder->file_count; ++i)
+        size += folder->files[i].size;
+    for(unsigned int i = 0; i < folder->folder_count; ++i)
+        size += _m_dev_tree_size(&folder->subfolders[i]);
+    return size;
+}
+
+// Watch a folder for changes
+void _m_dev_watch(m_dev_package * dev, const char * path) {
+    char full_path[1024];
+    if(!_m_dev_join(full_path, sizeof(full_path), dev->source, path)) return;
+    int wd = inotify_add_watch(dev->fd, full_path, IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    if(wd < 0) {
+        perror("Failed to watch directory");
+        return;
+    }
+
+    // Watch descriptors are reused when a folder is watched twice
+    for(unsigned long i = 0; i < dev->watch_count; ++i) {
+        if(dev->watches[i].wd == wd) {
+            free(dev->watches[i].path);
+            dev->watches[i].path = strdup(path);
+            return;
+        }
+    }
+    if(dev->watch_count == dev->watch_capacity) {
+        dev->watch_capacity = dev->watch_capacity ? dev->watch_capacity * 2 : 16;
+        dev->watches = (_m_watch *)realloc(dev->watches, sizeof(_m_watch) * dev->watch_capacity);
+    }
+    dev->watches[dev->watch_count].wd = wd;
+    dev->watches[dev->watch_count].path = strdup(path);
+    dev->watch_count++;
+}
+
+// Watch a folder and all of its subfolders
+void _m_dev_watch_tree(m_dev_package * dev, m_folder * folder, const char * path) {
+    _m_dev_watch(dev, path);
+    char child[1024];
+    for(unsigned int i = 0; i < folder->folder_count; ++i) {
+        if(_m_dev_join(child, sizeof(child), path, folder->subfolders[i].name))
+            _m_dev_watch_tree(dev, &folder->subfolders[i], child);
+    }
+}
+
+// Stop watching a folder and its subfolders
+void _m_dev_unwatch_tree(m_dev_package * dev, const char * path) {
+    size_t path_size = strlen(path);
+    for(unsigned long i = 0; i < dev->watch_count;) {
+        const char * watched = dev->watches[i].path;
+        if(strncmp(watched, path, path_size) == 0 && (watched[path_size] == '\0' || watched[path_size] == '/')) {
+            inotify_rm_watch(dev->fd, dev->watches[i].wd);
+            free(dev->watches[i].path);
+            dev->watches[i] = dev->watches[--dev->watch_count];
+        }
+        else i++;
+    }
+}
+
+// Copy live file data into a fresh buffer
+void _m_dev_compact_folder(m_folder * folder, uint8_t * old_data, uint8_t * data, unsigned long * offset) {
+    for(unsigned int i = 0; i < folder->file_count; ++i) {
+        m_file * file = &folder->files[i];
+        memcpy(data + *offset, old_data + file->offset, file->size);
+        file->offset = *offset;
+        *offset += file->size;
+    }
+    for(unsigned int i = 0; i < folder->folder_count; ++i)
+        _m_dev_compact_folder(&folder->subfolders[i], old_data, data, offset);
+}
+
+// Drop the data of replaced and removed files once enough has built up
+void _m_dev_compact(m_dev_package * dev) {
+    if(dev->pkg.data_size - dev->live_size < M_DEV_COMPACT_SIZE || dev->pkg.data_size < dev->live_size * 2)
+        return;
+    uint8_t * data = (uint8_t *)malloc(dev->live_size ? dev->live_size : 1);
+    unsigned long offset = 0;
+    _m_dev_compact_folder(&dev->pkg.root, dev->pkg.data, data, &offset);
+    free(dev->pkg.data);
+    dev->pkg.data = data;
+    dev->pkg.data_size = offset;
+}
+
+// Load a changed or new file into its folder
+bool _m_dev_update_file(m_dev_package * dev, const char * folder_path, const char * name) {
+    m_folder * folder = _m_dev_folder(dev, folder_path);
+    char path[1024], full_path[1024];
+    if(!_m_dev_join(path, sizeof(path), folder_path, name) || !_m_dev_join(full_path, sizeof(full_path), dev->source, path))
+        return false;
+    struct stat st;
+    if(!folder || stat(full_path, &st) != 0 || !S_ISREG(st.st_mode) || strlen(name) > 255)
+        return false;
+
+    // Find or add the file entry
+    m_file * file = NULL;
+    for(unsigned int i = 0; i < folder->file_count && !file; ++i) {
+        if(strcmp(folder->files[i].name, name) == 0)
+            file = &folder->files[i];
+    }
+    if(file) {
+        dev->live_size -= file->size;
+    }
+    else {
+        folder->files = (m_file *)realloc(folder->files, sizeof(m_file) * (folder->file_count + 1));
+        file = &folder->files[folder->file_count++];
+        file->name_size = strlen(name);
+        file->name = strdup(name);
+        dev->pkg.struct_size += M_FILE_BASE_SIZE + file->name_size;
+    }
+
+    // New content is appended, the old content is dropped on compaction
+    _load_file_data(full_path, file, &dev->pkg.data_size, &dev->pkg, NULL);
+    dev->live_size += file->size;
+    _m_dev_notify(dev, path, false);
+    return true;
+}
+
+// Remove a file from its folder
+bool _m_dev_remove_file(m_dev_package * dev, const char * folder_path, const char * name) {
+    m_folder * folder = _m_dev_folder(dev, folder_path);
+    char path[1024];
+    if(!_m_dev_join(path, sizeof(path), folder_path, name)) return false;
+    for(unsigned int i = 0; folder && i < folder->file_count; ++i) {
+        if(strcmp(folder->files[i].name, name) != 0) continue;
+        dev->live_size -= folder->files[i].size;
+        dev->pkg.struct_size -= M_FILE_BASE_SIZE + folder->files[i].name_size;
+        free(folder->files[i].name);
+        folder->files[i] = folder->files[--folder->file_count];
+        _m_dev_notify(dev, path, true);
+        return true;
+    }
+    return false;
+}
+
+// Remove a folder and everything in it, returns the number of files removed
+int _m_dev_remove_folder(m_dev_package * dev, const char * folder_path, const char * name) {
+    m_folder * folder = _m_dev_folder(dev, folder_path);
+    char path[1024];
+    if(!_m_dev_join(path, sizeof(path), folder_path, name)) return 0;
+    for(unsigned int i = 0; folder && i < folder->folder_count; ++i) {
+        m_folder * subfolder = &folder->subfolders[i];
+        if(strcmp(subfolder->name, name) != 0) continue;
+
+        _m_dev_unwatch_tree(dev, path);
+        int count = _m_dev_notify_tree(dev, subfolder, path, true);
+        dev->live_size -= _m_dev_tree_size(subfolder);
+        dev->pkg.struct_size -= _m_v1_folder_size(*subfolder);
+        _free_folder(*subfolder);
+        folder->subfolders[i] = folder->subfolders[--folder->folder_count];
+        return count;
+    }
+    return 0;
+}
+
+// Load a new folder, returns the number of files added
+int _m_dev_add_folder(m_dev_package * dev, const char * folder_path, const char * name) {
+    int count = _m_dev_remove_folder(dev, folder_path, name);
+    m_folder * folder = _m_dev_folder(dev, folder_path);
+    if(!folder || strlen(name) > 255) return count;
+
+    char path[1024], full_path[1024];
+    if(!_m_dev_join(path, sizeof(path), folder_path, name) || !_m_dev_join(full_path, sizeof(full_path), dev->source, path))
+        return count;
+
+    // Watch before loading so files written meanwhile aren't missed
+    _m_dev_watch(dev, path);
+    unsigned long start = dev->pkg.data_size;
+    m_folder subfolder = _load_folder(full_path, name, &dev->pkg.data_size, &dev->pkg, NULL);
+    folder->subfolders = (m_folder *)realloc(folder->subfolders, sizeof(m_folder) * (folder->folder_count + 1));
+    folder->subfolders[folder->folder_count++] = subfolder;
+    dev->live_size += dev->pkg.data_size - start;
+
+    _m_dev_watch_tree(dev, &subfolder, path);
+    return count + _m_dev_notify_tree(dev, &subfolder, path, false);
+}
+
+// Notify the files of an old folder that are missing from its new version, returns the number of files
+int _m_dev_notify_missing(m_dev_package * dev, m_folder * old_folder, m_folder * new_folder, const char * path) {
+    int count = 0;
+    char child[1024];
+    for(unsigned int i = 0; i < old_folder->file_count; ++i) {
+        bool found = false;
+        for(unsigned int j = 0; new_folder && j < new_folder->file_count && !found; ++j)
+            found = strcmp(old_folder->files[i].name, new_folder->files[j].name) == 0;
+        if(found || !_m_dev_join(child, sizeof(child), path, old_folder->files[i].name)) continue;
+        _m_dev_notify(dev, child, true);
+        count++;
+    }
+    for(unsigned int i = 0; i < old_folder->folder_count; ++i) {
+        m_folder * new_subfolder = NULL;
+        for(unsigned int j = 0; new_folder && j < new_folder->folder_count && !new_subfolder; ++j) {
+            if(strcmp(old_folder->subfolders[i].name, new_folder->subfolders[j].name) == 0)
+                new_subfolder = &new_folder->subfolders[j];
+        }
+        if(_m_dev_join(child, sizeof(child), path, old_folder->subfolders[i].name))
+            count += _m_dev_notify_missing(dev, &old_folder->subfolders[i], new_subfolder, child);
+    }
+    return count;
+}
+
+// Reload the whole source folder after inotify dropped events, returns the number of files notified
+// Every file is reported as changed and files that are gone as removed
+int _m_dev_rescan(m_dev_package * dev) {
+    for(unsigned long i = 0; i < dev->watch_count; ++i) {
+        inotify_rm_watch(dev->fd, dev->watches[i].wd);
+        free(dev->watches[i].path);
+    }
+    dev->watch_count = 0;
+
+    // Watch before loading so files written meanwhile aren't missed
+    _m_dev_watch(dev, "");
+    package pkg = load_package_folder(dev->source);
+    int count = _m_dev_notify_missing(dev, &dev->pkg.root, &pkg.root, "");
+    free_package(dev->pkg);
+    dev->pkg = pkg;
+    dev->live_size = pkg.data_size;
+    _m_dev_watch_tree(dev, &dev->pkg.root, "");
+    return count + _m_dev_notify_tree(dev, &dev->pkg.root, "", false);
+}
+
+// Mount a live package over a source folder, returns false if it couldn't be watched
+bool mount_dev_package(const char * folder, m_dev_package * dev) {
+    m_dev_package empty = {};
+    *dev = empty;
+    dev->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(dev->fd < 0) {
+        perror("Failed to start watching");
+        return false;
+    }
+
+    dev->source = strdup(folder);
+    dev->pkg = load_package_folder(folder);
+    dev->live_size = dev->pkg.data_size;
+    _m_dev_watch_tree(dev, &dev->pkg.root, "");
+    return true;
+}
+
+// Subscribe to changed paths
+void subscribe_dev_package(m_dev_package * dev, m_reload_callback callback, void * user) {
+    dev->subscribers = (_m_subscriber *)realloc(dev->subscribers, sizeof(_m_subscriber) * (dev->subscriber_count + 1));
+    dev->subscribers[dev->subscriber_count].callback = callback;
+    dev->subscribers[dev->subscriber_count].user = user;
+    dev->subscriber_count++;
+}
+
+// Apply pending filesystem changes to the package, waiting up to timeout_ms for the first one (0 to not wait)
+// Returns the number of changed file paths
+int poll_dev_package(m_dev_package * dev, int timeout_ms) {
+    struct pollfd pfd = { dev->fd, POLLIN, 0 };
+    if(poll(&pfd, 1, timeout_ms) <= 0)
+        return 0;
+
+    int changes = 0;
+    bool overflow = false;  // Events were dropped, the whole tree is rescanned
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while((length = read(dev->fd, buffer, sizeof(buffer))) > 0) {
+        for(char * p = buffer; p < buffer + length;) {
+            struct inotify_event * event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if(event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            if(overflow) continue;
+
+            // Find the watched folder
+            unsigned long w = 0;
+            while(w < dev->watch_count && dev->watches[w].wd != event->wd) w++;
+            if(w == dev->watch_count) continue;
+            if(event->mask & IN_IGNORED) {
+                free(dev->watches[w].path);
+                dev->watches[w] = dev->watches[--dev->watch_count];
+                continue;
+            }
+            if(!event->len) continue;
+
+            // Paths are copied as the watch list can change below
+            char * folder_path = strdup(dev->watches[w].path);
+            if(event->mask & IN_ISDIR) {
+                if(event->mask & (IN_CREATE | IN_MOVED_TO))
+                    changes += _m_dev_add_folder(dev, folder_path, event->name);
+                else if(event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    changes += _m_dev_remove_folder(dev, folder_path, event->name);
+            }
+            else if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                changes += _m_dev_update_file(dev, folder_path, event->name);
+            }
+            else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changes += _m_dev_remove_file(dev, folder_path, event->name);
+            }
+            free(folder_path);
+        }
+    }
+
+    if(overflow) {
+        fprintf(stderr, "Watch queue overflowed, reloading %s\n", dev->source);
+        changes += _m_dev_rescan(dev);
+    }
+    _m_dev_compact(dev);
+    return changes;
+}
+
+// Stop watching and free a development package
+void unmount_dev_package(m_dev_package * dev) {
+    for(unsigned long i = 0; i < dev->watch_count; ++i)
+        free(dev->watches[i].path);
+    free(dev->watches);
+    free(dev->subscribers);
+    free(dev->source);
+    close(dev->fd);
+    free_package(dev->pkg);
+    m_dev_package empty = {};
+    *dev = empty;
+}
+
+#endif
+
+// - Raylib integration functions -
+#ifdef RAYLIB_H
+
+// Decode an image from a file in the package without logging, so it can run on worker threads
+Image _m_decode_image(package pkg, m_file file) {
+    const char * ext = strrchr(file.name, '.');
+    if(ext == NULL) return {};
+    return LoadImageFromMemory(ext, get_file_binary(file, pkg), file.size);
+}
+
+// Load an image from a file in the package
+Image m_load_image(package pkg, m_file file) {
+    // Get file extension 
+    const char * ext = strrchr(file.name, '.');
+    if(ext == NULL) {
+        TraceLog(LOG_WARNING, "File has no extension: %s", file.name);
+        return {};
+    }
+
+    return _m_decode_image(pkg, file);
+}
+
+// Load an image from a path in the package
+Image m_load_image(package pkg, const char * path) {
+    m_file * file = get_file(pkg, path);
+    if(file) {
+        return m_load_image(pkg, *file);
+    } 
+    else {
+        TraceLog(LOG_WARNING, "File not found: %s", path);
+        return {};
+    }
+}
+
+// Load a texture from a file in the package
+Texture2D m_load_texture(package pkg, m_file file) {
+    Image img = m_load_image(pkg, file);
+    if(img.data) {
+        Texture2D texture = LoadTextureFromImage(img);
+        UnloadImage(img); // Free image data after loading texture
+        return texture;
+    } 
+    else {
+        TraceLog(LOG_WARNING, "Failed to load image from file: %s", file.name);
+        return {};
+    }
+}
+
+// Load a texture from a file in the package
+Texture2D m_load_texture(package pkg, const char * path) {
+    m_file * file = get_file(pkg, path);
+    if(file) {
+        return m_load_texture(pkg, *file);
+    } 
+    else {
+        TraceLog(LOG_WARNING, "File not found: %s", path);
+        return {};
+    }
+}
+
+
+// - Batch image loading -
+
+#ifndef _MSC_VER
+
+// Images are decoded on a pool of worker threads. Decoding only touches the CPU, so it doesn't need
+// a GL context, textures are still uploaded on the calling thread. An optional image cache keeps
+// decoded images of one package under a byte budget, keyed by the file they were decoded from, so
+// an image requested again is copied instead of decoded again.
+
+#define M_DECODE_THREADS 4      // Worker threads used when the processor count is unknown
+
+// Cached images are kept in slots, found through a hash of the file they were decoded from and
+// linked from most to least recently used, so lookups and evictions don't scan the cache.
+// Slot links are stored as index + 1, 0 marks the end of a list or an empty bucket
+
+typedef struct m_cached_image {
+    uint64_t offset;            // File the image was decoded from
+    uint64_t size;
+    Image image;
+    uint64_t bytes;             // Pixel data size
+    unsigned int chain;         // Next slot in the same bucket, or the next free slot
+    unsigned int newer, older;  // Neighbours in the use order
+} m_cached_image;
+
+// Decoded image cache of a package
+typedef struct m_image_cache {
+    uint64_t budget;            // Pixel data bytes allowed, 0 for no limit
+    uint64_t bytes;             // Pixel data bytes cached
+    m_cached_image * images;
+    unsigned int image_count;   // Slots holding an image
+    unsigned int slot_count, image_capacity;
+    unsigned int * buckets;     // Hash of (offset, size) to the first slot
+    unsigned int bucket_count;  // Power of two
+    unsigned int newest, oldest;
+    unsigned int free_slot;     // First unused slot
+    pthread_mutex_t lock;
+} m_image_cache;
+
+// Create an image cache, budget is in bytes of pixel data (0 for no limit)
+m_image_cache * m_create_image_cache(uint64_t budget) {
+    m_image_cache * cache = (m_image_cache *)calloc(1, sizeof(m_image_cache));
+    cache->budget = budget;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+// Unload every cached image and free the cache
+void m_free_image_cache(m_image_cache * cache) {
+    for(unsigned int slot = cache->newest; slot; slot = cache->images[slot - 1].older)
+        UnloadImage(cache->images[slot - 1].image);
+    free(cache->images);
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+// Bucket of a file in the image cache
+unsigned int _m_cache_bucket(m_image_cache * cache, uint64_t offset, uint64_t size) {
+    uint64_t hash = (offset ^ (size * 0x9E3779B97F4A7C15ull)) * 0xBF58476D1CE4E5B9ull;
+    return (unsigned int)(hash >> 32) & (cache->bucket_count - 1);
+}
+
+// Find the slot of a file in the image cache, 0 if it isn't cached
+unsigned int _m_cache_find(m_image_cache * cache, m_file file) {
+    if(!cache->bucket_count) return 0;
+    unsigned int slot = cache->buckets[_m_cache_bucket(cache, file.offset, file.size)];
+    while(slot && (cache->images[slot - 1].offset != file.offset || cache->images[slot - 1].size != file.size))
+        slot = cache->images[slot - 1].chain;
+    return slot;
+}
+
+// Unlink a slot from the use order
+void _m_cache_unlink(m_image_cache * cache, unsigned int slot) {
+    m_cached_image * cached = &cache->images[slot - 1];
+    if(cached->newer) cache->images[cached->newer - 1].older = cached->older;
+    else cache->newest = cached->older;
+    if(cached->older) cache->images[cached->older - 1].newer = cached->newer;
+    else cache->oldest = cached->newer;
+}
+
+// Link a slot as the most recently used
+void _m_cache_link_newest(m_image_cache * cache, unsigned int slot) {
+    m_cached_image * cached = &cache->images[slot - 1];
+    cached->newer = 0;
+    cached->older = cache->newest;
+    if(cache->newest) cache->images[cache->newest - 1].newer = slot;
+    else cache->oldest = slot;
+    cache->newest = slot;
+}
+
+// Unload the least recently used image and free its slot
+void _m_cache_evict_oldest(m_image_cache * cache) {
+    unsigned int slot = cache->oldest;
+    m_cached_image * cached = &cache->images[slot - 1];
+    unsigned int * link = &cache->buckets[_m_cache_bucket(cache, cached->offset, cached->size)];
+    while(*link != slot) link = &cache->images[*link - 1].chain;
+    *link = cached->chain;
+    _m_cache_unlink(cache, slot);
+    cache->bytes -= cached->bytes;
+    UnloadImage(cached->image);
+    cached->chain = cache->free_slot;
+    cache->free_slot = slot;
+    cache->image_count--;
+}
+
+// Double the buckets of the image cache, rehashing every cached image
+void _m_cache_grow_buckets(m_image_cache * cache) {
+    unsigned int bucket_count = cache->bucket_count ? cache->bucket_count * 2 : 64;
+    unsigned int * buckets = (unsigned int *)calloc(bucket_count, sizeof(unsigned int));
+    if(!buckets) return;
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+    for(unsigned int slot = cache->newest; slot; slot = cache->images[slot - 1].older) {
+        m_cached_image * cached = &cache->images[slot - 1];
+        unsigned int * head = &cache->buckets[_m_cache_bucket(cache, cached->offset, cached->size)];
+        cached->chain = *head;
+        *head = slot;
+    }
+}
+
+// Copy an image out of the cache, returns false if it isn't cached
+bool _m_cache_lookup(m_image_cache * cache, m_file file, Image * image) {
+    pthread_mutex_lock(&cache->lock);
+    unsigned int slot = _m_cache_find(cache, file);
+    if(slot) {
+        _m_cache_unlink(cache, slot);
+        _m_cache_link_newest(cache, slot);
+        *image = ImageCopy(cache->images[slot - 1].image);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return slot != 0;
+}
+
+// Add a copy of an image to the cache, evicting the least recently used images to fit the budget
+void _m_cache_insert(m_image_cache * cache, m_file file, Image image) {
+    uint64_t bytes = GetPixelDataSize(image.width, image.height, image.format);
+    if(cache->budget && bytes > cache->budget) return;
+    pthread_mutex_lock(&cache->lock);
+    if(_m_cache_find(cache, file)) {
+        // Another worker decoded it first
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    while(cache->budget && cache->bytes + bytes > cache->budget)
+        _m_cache_evict_oldest(cache);
+
+    // Reuse a freed slot, or add one
+    unsigned int slot = cache->free_slot;
+    if(slot) cache->free_slot = cache->images[slot - 1].chain;
+    else {
+        if(cache->slot_count == cache->image_capacity) {
+            cache->image_capacity = cache->image_capacity ? cache->image_capacity * 2 : 64;
+            cache->images = (m_cached_image *)realloc(cache->images, sizeof(m_cached_image) * cache->image_capacity);
+        }
+        slot = ++cache->slot_count;
+    }
+    if(cache->image_count >= cache->bucket_count) _m_cache_grow_buckets(cache);
+
+    m_cached_image * cached = &cache->images[slot - 1];
+    cached->offset = file.offset;
+    cached->size = file.size;
+    cached->image = ImageCopy(image);
+    cached->bytes = bytes;
+    unsigned int * head = &cache->buckets[_m_cache_bucket(cache, file.offset, file.size)];
+    cached->chain = *head;
+    *head = slot;
+    _m_cache_link_newest(cache, slot);
+    cache->image_count++;
+    cache->bytes += bytes;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Load an image from a file in the package through an image cache without logging
+Image _m_load_cached_image(package pkg, m_file file, m_image_cache * cache) {
+    Image image = {};
+    if(cache && _m_cache_lookup(cache, file, &image)) return image;
+    image = _m_decode_image(pkg, file);
+    if(cache && image.data) _m_cache_insert(cache, file, image);
+    return image;
+}
+
+// Log why an image couldn't be loaded, on the calling thread as TraceLog may not be thread safe
+void _m_image_warning(m_file file) {
+    if(strrchr(file.name, '.') == NULL) TraceLog(LOG_WARNING, "File has no extension: %s", file.name);
+    else TraceLog(LOG_WARNING, "Failed to load image from file: %s", file.name);
+}
+
+// Load an image from a file in the package through an image cache (cache may be null)
+Image m_load_image(package pkg, m_file file, m_image_cache * cache) {
+    Image image = _m_load_cached_image(pkg, file, cache);
+    if(!image.data) _m_image_warning(file);
+    return image;
+}
+
+typedef struct _m_decode_batch {
+    package pkg;
+    const m_file * files;
+    Image * images;
+    unsigned int count;
+    unsigned int next;          // Next image to decode
+    unsigned int loaded;
+    m_image_cache * cache;
+    pthread_mutex_t lock;
+} _m_decode_batch;
+
+// Decode images until the batch runs out, runs on each worker
+void * _m_decode_worker(void * argument) {
+    _m_decode_batch * batch = (_m_decode_batch *)argument;
+    unsigned int loaded = 0;
+    while(true) {
+        pthread_mutex_lock(&batch->lock);
+        unsigned int index = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        if(index >= batch->count) break;
+
+        // Files that weren't found have no name
+        Image empty = {};
+        batch->images[index] = empty;
+        if(!batch->files[index].name) continue;
+        batch->images[index] = _m_load_cached_image(batch->pkg, batch->files[index], batch->cache);
+        if(batch->images[index].data) loaded++;
+    }
+    pthread_mutex_lock(&batch->lock);
+    batch->loaded += loaded;
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+// Decode a batch of images from files in the package on worker threads (0 for one per processor)
+// Images that failed to load are left empty, returns the number of images loaded
+unsigned int m_load_images(package pkg, const m_file * files, Image * images, unsigned int count, unsigned int threads, m_image_cache * cache) {
+    if(threads == 0) {
+        #ifdef _SC_NPROCESSORS_ONLN
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 0 ? (unsigned int)processors : M_DECODE_THREADS;
+        #else
+        threads = M_DECODE_THREADS;
+        #endif
+    }
+    if(threads > count) threads = count;
+
+    _m_decode_batch batch = {};
+    batch.pkg = pkg;
+    batch.files = files;
+    batch.images = images;
+    batch.count = count;
+    batch.cache = cache;
+    pthread_mutex_init(&batch.lock, NULL);
+
+    // The calling thread decodes too
+    pthread_t * workers = (pthread_t *)malloc(sizeof(pthread_t) * (threads ? threads : 1));
+    unsigned int started = 0;
+    for(unsigned int i = 1; i < threads; ++i)
+        if(pthread_create(&workers[started], NULL, _m_decode_worker, &batch) == 0) started++;
+    _m_decode_worker(&batch);
+    for(unsigned int i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+    pthread_mutex_destroy(&batch.lock);
+
+    // Workers don't log, failures are reported here
+    for(unsigned int i = 0; i < count; ++i)
+        if(files[i].name && !images[i].data) _m_image_warning(files[i]);
+    return batch.loaded;
+}
+
+// Decode a batch of images from paths in the package on worker threads (0 for one per processor)
+unsigned int m_load_images(package pkg, const char ** paths, Image * images, unsigned int count, unsigned int threads, m_image_cache * cache) {
+    // Paths are resolved up front, looking them up may load folders
+    m_file * files = (m_file *)calloc(count ? count : 1, sizeof(m_file));
+    for(unsigned int i = 0; i < count; ++i) {
+        m_file * file = get_file(pkg, paths[i]);
+        if(file) files[i] = *file;
+        else TraceLog(LOG_WARNING, "File not found: %s", paths[i]);
+    }
+    unsigned int loaded = m_load_images(pkg, files, images, count, threads, cache);
+    free(files);
+    return loaded;
+}
+
+// Decode a batch of textures on worker threads then upload them on the calling thread
+unsigned int m_load_textures(package pkg, const char ** paths, Texture2D * textures, unsigned int count, unsigned int threads, m_image_cache * cache) {
+    Image * images = (Image *)calloc(count ? count : 1, sizeof(Image));
+    m_load_images(pkg, paths, images, count, threads, cache);
+    unsigned int loaded = 0;
+    for(unsigned int i = 0; i < count; ++i) {
+        Texture2D empty = {};
+        textures[i] = empty;
+        if(!images[i].data) continue;
+        textures[i] = LoadTextureFromImage(images[i]);
+        UnloadImage(images[i]);
+        if(textures[i].id) loaded++;
+    }
+    free(images);
+    return loaded;
+}
+
+#endif
+
 #endif
 
 #endif
\ No newline at end of file
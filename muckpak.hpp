@@ -6,6 +6,21 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <future>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifdef MUCKPAK_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace Muckrat {
     // Define logging function
@@ -58,6 +73,85 @@ namespace Muckrat {
         }
     };
 
+    // - Version 2 archive format -
+    // Fixed width, little endian and naturally aligned records that can be queried in place
+
+    const uint32_t VERSION_1 = 1;
+    const uint32_t VERSION_2 = 2;
+    const uint32_t NO_PARENT = 0xFFFFFFFF;
+
+    // Convert little endian archive values to host values
+    inline uint32_t FromLE(uint32_t value) {
+        #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return __builtin_bswap32(value);
+        #else
+        return value;
+        #endif
+    }
+    inline uint64_t FromLE(uint64_t value) {
+        #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return __builtin_bswap64(value);
+        #else
+        return value;
+        #endif
+    }
+
+    // Archive header, the first 64 bytes of a version 2 archive
+    struct ArchiveHeader {
+        char id[4];
+        uint8_t marker[8];      // All 0xFF, in place of the version 1 structure size
+        uint32_t version;
+        uint64_t tocOffset;
+        uint64_t tocSize;
+        uint64_t dataOffset;
+        uint64_t dataSize;
+        uint32_t folderCount;
+        uint32_t fileCount;
+        uint32_t volumeCount;   // Number of volumes (0 or 1 for a single file archive)
+        uint32_t volume;        // Index of this volume, only volume 0 has a table of contents
+    };
+
+    // Folder record, children are stored contiguously and sorted by name
+    struct FolderRecord {
+        uint32_t name;          // Offset of the name in the string table
+        uint32_t parent;
+        uint32_t firstFile;
+        uint32_t fileCount;
+        uint32_t firstFolder;
+        uint32_t folderCount;
+    };
+
+    // File record
+    struct FileRecord {
+        uint32_t name;          // Offset of the name in the string table
+        uint32_t volume;        // Volume holding the file data
+        uint64_t size;
+        uint64_t offset;        // Relative to the data section of its volume
+        uint64_t hash;
+    };
+
+    // Multi-volume archives split the file data across volume files (pack.000.mpak, pack.001.mpak, ...)
+    // with the table of contents in volume 0
+    const uint32_t MAX_VOLUMES = 1000;
+
+    // Get the filename of a volume, the volume number goes before the extension (pack.000.mpak to pack.001.mpak)
+    inline std::string VolumeFilename(const std::string & filename, uint32_t volume) {
+        size_t name = filename.rfind('/');
+        name = name == std::string::npos ? 0 : name + 1;
+        size_t extension = filename.rfind('.');
+        if(extension == std::string::npos || extension <= name) extension = filename.size();
+
+        // Replace the number of another volume
+        auto digit = [](char c) { return c >= '0' && c <= '9'; };
+        size_t stemEnd = extension;
+        if(stemEnd - name > 4 && filename[stemEnd - 4] == '.' && digit(filename[stemEnd - 3])
+            && digit(filename[stemEnd - 2]) && digit(filename[stemEnd - 1]))
+            stemEnd -= 4;
+        char number[16];
+        snprintf(number, sizeof(number), ".%03u", volume);
+        return filename.substr(0, stemEnd) + number + filename.substr(extension);
+    }
+
     // Package file
     class File {
         public:
@@ -75,6 +169,146 @@ namespace Muckrat {
         }
     };
 
+    // Match a name against a single glob segment (supports *, ? and [...] classes)
+    inline bool GlobMatch(const char * pattern, size_t patternSize, const char * name, size_t nameSize) {
+        size_t p = 0, n = 0;
+        size_t star = std::string::npos, starN = 0;    // Last star, for backtracking
+        while(n < nameSize) {
+            if(p < patternSize && pattern[p] == '*') {
+                star = p++;
+                starN = n;
+                continue;
+            }
+            if(p < patternSize && pattern[p] == '[') {
+                // Character class
+                size_t q = p + 1;
+                bool negate = q < patternSize && (pattern[q] == '!' || pattern[q] == '^');
+                if(negate) q++;
+                bool matched = false;
+                size_t start = q;
+                while(q < patternSize && (pattern[q] != ']' || q == start)) {
+                    if(q + 2 < patternSize && pattern[q + 1] == '-' && pattern[q + 2] != ']') {
+                        matched |= name[n] >= pattern[q] && name[n] <= pattern[q + 2];
+                        q += 3;
+                    } else {
+                        matched |= name[n] == pattern[q];
+                        q++;
+                    }
+                }
+                if(q < patternSize && matched != negate) {
+                    p = q + 1;
+                    n++;
+                    continue;
+                }
+            }
+            else if(p < patternSize && (pattern[p] == '?' || pattern[p] == name[n])) {
+                p++;
+                n++;
+                continue;
+            }
+
+            // Mismatch, let the last star take one more character
+            if(star == std::string::npos) return false;
+            p = star + 1;
+            n = ++starN;
+        }
+        while(p < patternSize && pattern[p] == '*') p++;
+        return p == patternSize;
+    }
+
+    // Split a glob pattern into its non empty segments, repeated "**" segments are merged
+    inline std::vector<std::string> SplitPattern(const std::string & pattern) {
+        std::vector<std::string> segments;
+        size_t start = 0;
+        while(start <= pattern.size()) {
+            size_t end = pattern.find('/', start);
+            if(end == std::string::npos) end = pattern.size();
+            std::string segment = pattern.substr(start, end - start);
+            if(!segment.empty() && !(segment == "**" && !segments.empty() && segments.back() == "**"))
+                segments.push_back(segment);
+            start = end + 1;
+        }
+        return segments;
+    }
+
+    // Query callback, gets the file's path relative to the root and returns false to stop the query
+    typedef std::function<bool(const std::string & path, File & file)> QueryCallback;
+
+    // - Prefetching -
+    // Prefetches warm a folder's payloads on a background thread so the first access doesn't stall
+
+    const uint64_t PREFETCH_GAP = 65536;    // Largest gap between payloads read through to join their ranges
+    const uint64_t PREFETCH_PAGE = 4096;    // Stride used to touch prefetched data
+
+    // Byte range of payloads, relative to the file data of a volume
+    struct Range {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t volume = 0;
+    };
+
+    // Sort ranges and join the ones in the same volume that overlap or sit close together
+    inline std::vector<Range> CoalesceRanges(std::vector<Range> ranges) {
+        std::sort(ranges.begin(), ranges.end(), [](const Range & a, const Range & b) {
+            return a.volume != b.volume ? a.volume < b.volume : a.offset < b.offset;
+        });
+        std::vector<Range> joined;
+        for(const Range & range : ranges) {
+            if(range.size == 0) continue;
+            if(!joined.empty() && range.volume == joined.back().volume && range.offset <= joined.back().offset + joined.back().size + PREFETCH_GAP) {
+                Range & last = joined.back();
+                last.size = std::max(last.offset + last.size, range.offset + range.size) - last.offset;
+            }
+            else joined.push_back(range);
+        }
+        return joined;
+    }
+
+    // Warm ranges of data, advising the kernel first when the data is mapped, returns the bytes warmed
+    // Ranges are in data, or in the data of each volume for multi-volume archives
+    inline uint64_t WarmRanges(const uint8_t * data, uint8_t * const * volumes, const std::vector<Range> & ranges, bool mapped) {
+        #ifdef MUCKPAK_MMAP
+        if(mapped) {
+            // Start reading every volume at once
+            uintptr_t page = sysconf(_SC_PAGESIZE);
+            for(const Range & range : ranges) {
+                uintptr_t start = (uintptr_t)((volumes ? volumes[range.volume] : data) + range.offset);
+                uintptr_t end = start + range.size;
+                start &= ~(page - 1);
+                madvise((void *)start, end - start, MADV_WILLNEED);
+            }
+        }
+        #else
+        (void)mapped;
+        #endif
+
+        // Touch every page so it is resident once the prefetch completes
+        uint64_t bytes = 0;
+        for(const Range & range : ranges) {
+            const volatile uint8_t * bytesIn = (volumes ? volumes[range.volume] : data) + range.offset;
+            for(uint64_t offset = 0; offset < range.size; offset += PREFETCH_PAGE)
+                (void)bytesIn[offset];
+            (void)bytesIn[range.size - 1];
+            bytes += range.size;
+        }
+        return bytes;
+    }
+
+    // Start warming ranges on a background thread
+    inline std::future<uint64_t> StartPrefetch(const uint8_t * data, std::vector<Range> ranges, bool mapped, uint8_t * const * volumes = nullptr) {
+        std::vector<Range> joined = CoalesceRanges(std::move(ranges));
+        return std::async(std::launch::async, [data, volumes, joined, mapped]() {
+            return WarmRanges(data, volumes, joined, mapped);
+        });
+    }
+
+    // A prefetch of a path that wasn't found, completes straight away
+    inline std::future<uint64_t> EmptyPrefetch() {
+        std::promise<uint64_t> promise;
+        promise.set_value(0);
+        return promise.get_future();
+    }
+
     // Package folder
     class Folder {
         public:
@@ -115,12 +349,372 @@ namespace Muckrat {
             if(folderCount) delete[] folders;
         }
     };
-    
+
+    // Read only view over a version 2 archive, queried in place without loading
+    class PackageView {
+        private:
+        const ArchiveHeader * header = nullptr;
+        const FolderRecord * folders = nullptr;
+        const FileRecord * files = nullptr;
+        uint8_t * strings = nullptr;
+        uint8_t * fileData = nullptr;
+        uint8_t * const * volumes = nullptr;   // Data of each volume (multi-volume archives only)
+
+        // Compare a record name with a key
+        int Compare(uint32_t name, const char * key, size_t keySize) const {
+            const uint8_t * string = strings + FromLE(name);
+            size_t size = string[0];
+            int result = memcmp(string + 1, key, size < keySize ? size : keySize);
+            if(result) return result;
+            return (size > keySize) - (size < keySize);
+        }
+
+        // First record in a sorted run whose name is not below a key
+        template<typename Record>
+        uint32_t LowerBound(const Record * records, uint32_t count, const char * key, size_t keySize) const {
+            uint32_t low = 0, high = count;
+            while(low < high) {
+                uint32_t mid = low + (high - low) / 2;
+                if(Compare(records[mid].name, key, keySize) < 0) low = mid + 1;
+                else high = mid;
+            }
+            return low;
+        }
+
+        // Check if a record name starts with a key
+        bool HasPrefix(uint32_t name, const char * key, size_t keySize) const {
+            const uint8_t * string = strings + FromLE(name);
+            return string[0] >= keySize && memcmp(string + 1, key, keySize) == 0;
+        }
+
+        // Report every file below a folder
+        bool _QueryAll(const FolderRecord * folder, std::string & path, const QueryCallback & callback) const {
+            size_t length = path.size();
+            const FileRecord * fileRecords = files + FromLE(folder->firstFile);
+            for(uint32_t i = 0; i < FromLE(folder->fileCount); ++i) {
+                File file = MakeFile(&fileRecords[i]);
+                path.resize(length);
+                path.append(file.name.cStr(), file.name.length());
+                if(!callback(path, file)) return false;
+            }
+            const FolderRecord * folderRecords = folders + FromLE(folder->firstFolder);
+            for(uint32_t i = 0; i < FromLE(folder->folderCount); ++i) {
+                ShortString name = Name(folderRecords[i].name);
+                path.resize(length);
+                path.append(name.cStr(), name.length()).push_back('/');
+                if(!_QueryAll(&folderRecords[i], path, callback)) return false;
+            }
+            path.resize(length);
+            return true;
+        }
+
+        // Walk a folder against the pattern from a segment on
+        bool _Query(const FolderRecord * folder, const std::vector<std::string> & segments, size_t index, std::string & path, const QueryCallback & callback) const {
+            if(index == segments.size()) return true;
+            const std::string & segment = segments[index];
+            bool last = index + 1 == segments.size();
+            size_t length = path.size();
+            const FolderRecord * folderRecords = folders + FromLE(folder->firstFolder);
+            uint32_t folderCount = FromLE(folder->folderCount);
+
+            if(segment == "**") {
+                if(last) return _QueryAll(folder, path, callback);
+
+                // Match zero folders, then one or more
+                if(!_Query(folder, segments, index + 1, path, callback)) return false;
+                for(uint32_t i = 0; i < folderCount; ++i) {
+                    ShortString name = Name(folderRecords[i].name);
+                    path.resize(length);
+                    path.append(name.cStr(), name.length()).push_back('/');
+                    if(!_Query(&folderRecords[i], segments, index, path, callback)) return false;
+                }
+                path.resize(length);
+                return true;
+            }
+
+            // Only names sharing the segment's literal prefix can match
+            size_t literal = segment.find_first_of("*?[");
+            if(literal == std::string::npos) literal = segment.size();
+            if(last) {
+                const FileRecord * fileRecords = files + FromLE(folder->firstFile);
+                uint32_t fileCount = FromLE(folder->fileCount);
+                for(uint32_t i = LowerBound(fileRecords, fileCount, segment.data(), literal); i < fileCount && HasPrefix(fileRecords[i].name, segment.data(), literal); ++i) {
+                    ShortString name = Name(fileRecords[i].name);
+                    if(!GlobMatch(segment.data(), segment.size(), name.cStr(), name.length())) continue;
+                    File file = MakeFile(&fileRecords[i]);
+                    path.resize(length);
+                    path.append(name.cStr(), name.length());
+                    if(!callback(path, file)) return false;
+                }
+                path.resize(length);
+                return true;
+            }
+
+            for(uint32_t i = LowerBound(folderRecords, folderCount, segment.data(), literal); i < folderCount && HasPrefix(folderRecords[i].name, segment.data(), literal); ++i) {
+                ShortString name = Name(folderRecords[i].name);
+                if(!GlobMatch(segment.data(), segment.size(), name.cStr(), name.length())) continue;
+                path.resize(length);
+                path.append(name.cStr(), name.length()).push_back('/');
+                if(!_Query(&folderRecords[i], segments, index + 1, path, callback)) return false;
+            }
+            path.resize(length);
+            return true;
+        }
+
+        public:
+        bool valid = false;
+
+        // Get the format version of archive data (0 if it isn't an archive)
+        static uint32_t Version(const uint8_t * source, size_t size) {
+            if(size >= sizeof(ArchiveHeader)) {
+                const ArchiveHeader * header = (const ArchiveHeader *)source;
+                bool marked = true;
+                for(unsigned int i = 0; i < sizeof(header->marker); ++i)
+                    marked &= header->marker[i] == 0xFF;
+                if(marked) return FromLE(header->version);
+            }
+            return size >= 20 ? VERSION_1 : 0;
+        }
+
+        // Open a view over the header and table of contents of archive data, with the file data elsewhere
+        bool OpenIndex(uint8_t * source, size_t size, uint8_t * data) {
+            valid = false;
+            if(Version(source, size) != VERSION_2) return false;
+            const ArchiveHeader * head = (const ArchiveHeader *)source;
+            uint64_t tocOffset = FromLE(head->tocOffset), tocSize = FromLE(head->tocSize);
+            uint64_t recordsSize = sizeof(FolderRecord) * (uint64_t)FromLE(head->folderCount)
+                + sizeof(FileRecord) * (uint64_t)FromLE(head->fileCount);
+
+            // Check the table of contents fits, only the first volume has one
+            if(tocOffset % 8 || tocOffset < sizeof(ArchiveHeader) || tocOffset > size || tocSize > size - tocOffset
+                || recordsSize > tocSize || FromLE(head->folderCount) == 0 || FromLE(head->volume) != 0
+                || FromLE(head->volumeCount) > MAX_VOLUMES)
+                return false;
+
+            header = head;
+            folders = (const FolderRecord *)(source + tocOffset);
+            files = (const FileRecord *)(folders + FromLE(head->folderCount));
+            strings = (uint8_t *)(files + FromLE(head->fileCount));
+            fileData = data;
+            volumes = nullptr;
+            valid = true;
+            return true;
+        }
+
+        // Open a view over archive data, constant time and no allocations
+        bool Open(uint8_t * source, size_t size) {
+            valid = false;
+            if(Version(source, size) != VERSION_2 || size < sizeof(ArchiveHeader)) return false;
+            const ArchiveHeader * head = (const ArchiveHeader *)source;
+            uint64_t dataOffset = FromLE(head->dataOffset), dataSize = FromLE(head->dataSize);
+
+            // Check the file data fits in the archive
+            if(dataOffset > size || dataSize > size - dataOffset) return false;
+            return OpenIndex(source, size, source + dataOffset);
+        }
+
+        // Number of volumes of the archive (1 for a single file archive)
+        uint32_t VolumeCount() const {
+            return FromLE(header->volumeCount) ? FromLE(header->volumeCount) : 1;
+        }
+
+        // Get the data section of a volume of the archive, null if the data isn't that volume
+        uint8_t * VolumeData(uint8_t * source, size_t size, uint32_t volume) const {
+            if(Version(source, size) != VERSION_2 || size < sizeof(ArchiveHeader)) return nullptr;
+            const ArchiveHeader * head = (const ArchiveHeader *)source;
+            uint64_t dataOffset = FromLE(head->dataOffset), dataSize = FromLE(head->dataSize);
+            if(FromLE(head->volume) != volume || head->volumeCount != header->volumeCount || memcmp(head->id, header->id, 4) != 0
+                || head->tocSize != header->tocSize || head->folderCount != header->folderCount || head->fileCount != header->fileCount
+                || dataOffset > size || dataSize > size - dataOffset)
+                return nullptr;
+            return source + dataOffset;
+        }
+
+        // Set the data of every volume of a multi-volume archive (from VolumeData), which must outlive the view
+        void SetVolumes(uint8_t * const * volumeData) {
+            volumes = volumeData;
+        }
+
+        const ArchiveHeader * Header() const { return header; }
+        const FolderRecord * Root() const { return folders; }
+        const FolderRecord * Folders() const { return folders; }
+        const FileRecord * Files() const { return files; }
+
+        // Get the name of a record
+        ShortString Name(uint32_t name) const {
+            ShortString string;
+            string.content = strings + FromLE(name);
+            return string;
+        }
+
+        // Make a file from a record
+        File MakeFile(const FileRecord * record) const {
+            File file;
+            file.name = Name(record->name);
+            file.data = (volumes ? volumes[FromLE(record->volume)] : fileData) + FromLE(record->offset);
+            file.size = FromLE(record->size);
+            return file;
+        }
+
+        // Get subfolder in a folder (null if not found)
+        const FolderRecord * FindFolder(const FolderRecord * folder, const char * name, size_t size) const {
+            const FolderRecord * children = folders + FromLE(folder->firstFolder);
+            uint32_t low = 0, high = FromLE(folder->folderCount);
+            while(low < high) {
+                uint32_t mid = low + (high - low) / 2;
+                int result = Compare(children[mid].name, name, size);
+                if(result == 0) return &children[mid];
+                if(result < 0) low = mid + 1;
+                else high = mid;
+            }
+            return nullptr;
+        }
+
+        // Get file in a folder (null if not found)
+        const FileRecord * FindFile(const FolderRecord * folder, const char * name, size_t size) const {
+            const FileRecord * children = files + FromLE(folder->firstFile);
+            uint32_t low = 0, high = FromLE(folder->fileCount);
+            while(low < high) {
+                uint32_t mid = low + (high - low) / 2;
+                int result = Compare(children[mid].name, name, size);
+                if(result == 0) return &children[mid];
+                if(result < 0) low = mid + 1;
+                else high = mid;
+            }
+            return nullptr;
+        }
+
+        // Get a folder from a path (null if not found)
+        const FolderRecord * getFolder(const std::string & path) const {
+            const FolderRecord * folder = Root();
+            size_t start = 0;
+            while(folder && start < path.size()) {
+                size_t end = path.find('/', start);
+                if(end == std::string::npos) end = path.size();
+                if(end > start) folder = FindFolder(folder, path.data() + start, end - start);
+                start = end + 1;
+            }
+            return folder;
+        }
+
+        // Get a file record from a path (null if not found)
+        const FileRecord * getFileRecord(const std::string & path) const {
+            size_t split = path.rfind('/');
+            size_t nameStart = split == std::string::npos ? 0 : split + 1;
+
+            // Find the containing folder
+            const FolderRecord * folder = Root();
+            size_t start = 0;
+            while(folder && start < nameStart) {
+                size_t end = path.find('/', start);
+                if(end > start) folder = FindFolder(folder, path.data() + start, end - start);
+                start = end + 1;
+            }
+
+            if(folder == nullptr) return nullptr;
+            return FindFile(folder, path.data() + nameStart, path.size() - nameStart);
+        }
+
+        // Get a file from a path (file data is null if not found)
+        File getFile(const std::string & path) const {
+            const FileRecord * record = getFileRecord(path);
+            if(record == nullptr) {
+                Log("Failed to find file '" + path + "'");
+                return {};
+            }
+            return MakeFile(record);
+        }
+
+        // Collect the payload ranges of a folder
+        void Ranges(const FolderRecord * folder, std::vector<Range> & ranges) const {
+            const FileRecord * fileRecords = files + FromLE(folder->firstFile);
+            for(uint32_t i = 0; i < FromLE(folder->fileCount); ++i)
+                ranges.push_back({ FromLE(fileRecords[i].offset), FromLE(fileRecords[i].size), FromLE(fileRecords[i].volume) });
+            const FolderRecord * folderRecords = folders + FromLE(folder->firstFolder);
+            for(uint32_t i = 0; i < FromLE(folder->folderCount); ++i)
+                Ranges(&folderRecords[i], ranges);
+        }
+
+        // Start warming a folder or file's payloads in the background, the future holds the bytes warmed
+        std::future<uint64_t> Prefetch(const std::string & path, bool mapped = false) const {
+            std::vector<Range> ranges;
+            const FileRecord * file = path.empty() ? nullptr : getFileRecord(path);
+            const FolderRecord * folder = file ? nullptr : getFolder(path);
+            if(file) ranges.push_back({ FromLE(file->offset), FromLE(file->size), FromLE(file->volume) });
+            else if(folder) Ranges(folder, ranges);
+            else {
+                Log("Failed to find prefetch path '" + path + "'");
+                return EmptyPrefetch();
+            }
+            return StartPrefetch(fileData, std::move(ranges), mapped, volumes);
+        }
+
+        // Call back for every file whose path matches a glob pattern, such as "levels/forest/**/*.png"
+        // Literal name prefixes are found with the sorted index, returns false if the query was stopped
+        bool Query(const std::string & pattern, const QueryCallback & callback) const {
+            std::vector<std::string> segments = SplitPattern(pattern);
+            std::string path;
+            return _Query(Root(), segments, 0, path, callback);
+        }
+
+        // Call back for every file whose path starts with a prefix, such as "levels/forest/"
+        bool QueryPrefix(const std::string & prefix, const QueryCallback & callback) const {
+            // Follow the complete folder names in the prefix
+            const FolderRecord * folder = Root();
+            std::string path;
+            size_t start = 0, end;
+            while(folder && (end = prefix.find('/', start)) != std::string::npos) {
+                if(end > start) {
+                    folder = FindFolder(folder, prefix.data() + start, end - start);
+                    path.append(prefix, start, end - start).push_back('/');
+                }
+                start = end + 1;
+            }
+            if(folder == nullptr) return true;
+
+            // Match the remaining partial name against the sorted files and subfolders
+            const char * key = prefix.data() + start;
+            size_t keySize = prefix.size() - start;
+            size_t length = path.size();
+            const FileRecord * fileRecords = files + FromLE(folder->firstFile);
+            uint32_t count = FromLE(folder->fileCount);
+            for(uint32_t i = LowerBound(fileRecords, count, key, keySize); i < count && HasPrefix(fileRecords[i].name, key, keySize); ++i) {
+                File file = MakeFile(&fileRecords[i]);
+                path.resize(length);
+                path.append(file.name.cStr(), file.name.length());
+                if(!callback(path, file)) return false;
+            }
+            const FolderRecord * folderRecords = folders + FromLE(folder->firstFolder);
+            count = FromLE(folder->folderCount);
+            for(uint32_t i = LowerBound(folderRecords, count, key, keySize); i < count && HasPrefix(folderRecords[i].name, key, keySize); ++i) {
+                ShortString name = Name(folderRecords[i].name);
+                path.resize(length);
+                path.append(name.cStr(), name.length()).push_back('/');
+                if(!_QueryAll(&folderRecords[i], path, callback)) return false;
+            }
+            return true;
+        }
+    };
+
     class Package {
         private:
         unsigned long headerSize, dataSize;
-        uint8_t * data;     // The package's raw data
+        uint8_t * data = nullptr;   // The package's raw data
         uint8_t * fileData; // Pointer to the file content section of data
+        std::vector<uint8_t *> volumeSources;   // Raw data of each volume after the first (owned when loaded from files)
+        std::vector<uint8_t *> volumeData;      // File content section of each volume
+
+        // Read a whole file into a new buffer (null if it couldn't be read)
+        static uint8_t * _ReadFile(const std::string & filename, size_t & size) {
+            std::fstream file(filename, std::ios::in | std::ios::binary);
+            if(!file.is_open()) return nullptr;
+            file.seekg(0, std::ios::end);
+            size = file.tellg();
+            file.seekg(0, std::ios::beg);
+            uint8_t * buffer = new uint8_t[size];
+            file.read((char*)buffer, size);
+            return buffer;
+        }
 
         Folder _LoadFolder(uint8_t *& source) {
             Folder folder = {};
@@ -161,15 +755,118 @@ namespace Muckrat {
             return folder;
         }
 
+        // Load a folder from a version 2 archive
+        Folder _LoadFolderV2(const FolderRecord * record) {
+            Folder folder = {};
+            folder.name = view.Name(record->name);
+            folder.fileCount = FromLE(record->fileCount);
+            folder.folderCount = FromLE(record->folderCount);
+            folder.files = new File[folder.fileCount];
+            folder.folders = new Folder[folder.folderCount];
+
+            // Load files
+            const FileRecord * files = view.Files() + FromLE(record->firstFile);
+            for(unsigned int i = 0; i < folder.fileCount; ++i)
+                folder.files[i] = view.MakeFile(&files[i]);
+
+            // Load subfolders
+            const FolderRecord * folders = view.Folders() + FromLE(record->firstFolder);
+            for(unsigned int i = 0; i < folder.folderCount; ++i)
+                folder.folders[i] = _LoadFolderV2(&folders[i]);
+
+            return folder;
+        }
+
+        // Report every file below a folder
+        bool _QueryAll(Folder & folder, std::string & path, const QueryCallback & callback) {
+            size_t length = path.size();
+            for(uint32_t i = 0; i < folder.fileCount; ++i) {
+                path.resize(length);
+                path.append(folder.files[i].name.cStr(), folder.files[i].name.length());
+                if(!callback(path, folder.files[i])) return false;
+            }
+            for(uint32_t i = 0; i < folder.folderCount; ++i) {
+                path.resize(length);
+                path.append(folder.folders[i].name.cStr(), folder.folders[i].name.length()).push_back('/');
+                if(!_QueryAll(folder.folders[i], path, callback)) return false;
+            }
+            path.resize(length);
+            return true;
+        }
+
+        // Walk a folder against the pattern from a segment on
+        bool _Query(Folder & folder, const std::vector<std::string> & segments, size_t index, std::string & path, const QueryCallback & callback) {
+            if(index == segments.size()) return true;
+            const std::string & segment = segments[index];
+            bool last = index + 1 == segments.size();
+            size_t length = path.size();
+
+            if(segment == "**") {
+                if(last) return _QueryAll(folder, path, callback);
+
+                // Match zero folders, then one or more
+                if(!_Query(folder, segments, index + 1, path, callback)) return false;
+                for(uint32_t i = 0; i < folder.folderCount; ++i) {
+                    path.resize(length);
+                    path.append(folder.folders[i].name.cStr(), folder.folders[i].name.length()).push_back('/');
+                    if(!_Query(folder.folders[i], segments, index, path, callback)) return false;
+                }
+                path.resize(length);
+                return true;
+            }
+
+            if(last) {
+                for(uint32_t i = 0; i < folder.fileCount; ++i) {
+                    ShortString name = folder.files[i].name;
+                    if(!GlobMatch(segment.data(), segment.size(), name.cStr(), name.length())) continue;
+                    path.resize(length);
+                    path.append(name.cStr(), name.length());
+                    if(!callback(path, folder.files[i])) return false;
+                }
+                path.resize(length);
+                return true;
+            }
+
+            // Only descend into matching subfolders
+            for(uint32_t i = 0; i < folder.folderCount; ++i) {
+                ShortString name = folder.folders[i].name;
+                if(!GlobMatch(segment.data(), segment.size(), name.cStr(), name.length())) continue;
+                path.resize(length);
+                path.append(name.cStr(), name.length()).push_back('/');
+                if(!_Query(folder.folders[i], segments, index + 1, path, callback)) return false;
+            }
+            path.resize(length);
+            return true;
+        }
+
         public:
         bool loaded = false;
-        char * id;      // Optional 4 character package id
-        Folder root;    // The package root folder
+        char * id;          // Optional 4 character package id
+        Folder root;        // The package root folder
+        uint32_t version;   // Archive format version
+        PackageView view;   // In place view (valid for version 2 archives)
 
         // Load the package from an array of bytes
         void LoadFromMemory(uint8_t * source) {
+            LoadFromMemory(source, (size_t)-1);
+        }
+
+        // Load the package from an array of bytes of a known size
+        void LoadFromMemory(uint8_t * source, size_t size) {
             data = source;
             id = (char*)source; // ID is first 4 bytes of data
+
+            // Version 2 archives are read through the view
+            if(view.Open(source, size)) {
+                version = VERSION_2;
+                headerSize = FromLE(view.Header()->dataOffset);
+                dataSize = FromLE(view.Header()->dataSize);
+                fileData = data + headerSize;
+                root = _LoadFolderV2(view.Root());
+                return;
+            }
+
+            version = VERSION_1;
             headerSize = *(unsigned long *)(source + 4);
             dataSize =  *(unsigned long *)(source + 12);
 
@@ -181,6 +878,34 @@ namespace Muckrat {
             root = _LoadFolder(structureData);
         }
 
+        // Load a multi-volume package from the arrays of bytes of each of its volumes, in volume order
+        bool LoadFromVolumes(const std::vector<uint8_t *> & sources, const std::vector<size_t> & sizes) {
+            data = sources.empty() ? nullptr : sources[0];
+            if(data == nullptr || !view.Open(data, sizes[0]) || view.VolumeCount() != sources.size()) {
+                Log(std::string("Failed to load volumes, wrong volume count"));
+                return false;
+            }
+
+            // Find the data of every volume before any files are made
+            volumeData.assign(sources.size(), nullptr);
+            for(size_t i = 0; i < sources.size(); ++i) {
+                volumeData[i] = view.VolumeData(sources[i], sizes[i], i);
+                if(volumeData[i] == nullptr) {
+                    Log("Failed to load volume " + std::to_string(i) + ", it doesn't belong to the archive");
+                    return false;
+                }
+            }
+            view.SetVolumes(volumeData.data());
+
+            id = (char*)data;
+            version = VERSION_2;
+            headerSize = FromLE(view.Header()->dataOffset);
+            dataSize = FromLE(view.Header()->dataSize);
+            fileData = data + headerSize;
+            root = _LoadFolderV2(view.Root());
+            return true;
+        }
+
         // Get a file from a path
         File getFile(std::string path) {
             size_t index = 0;
@@ -210,27 +935,134 @@ namespace Muckrat {
             return *file;
         }
 
+        Package() = default;
+
+        // Load a package from a file, for multi-volume archives this is the first volume
         Package(std::string filename) {
-            std::fstream file(filename, std::ios::in | std::ios::binary);
-            if(!file.is_open()) {
+            size_t size = 0;
+            data = _ReadFile(filename, size);
+            if(data == nullptr) {
                 Log("Failed to load file '" + filename + "'");
-                data = nullptr;
                 loaded = false;
                 return;
             }
 
-            // Load file data
-            file.seekg(0, std::ios::end);
-		    size_t size = file.tellg();
-		    file.seekg(0, std::ios::beg);
-		    data = new uint8_t[size];
-		    file.read((char*)data, size);
+            // Read the rest of a multi-volume archive's volumes in parallel
+            PackageView first;
+            if(first.Open(data, size) && first.VolumeCount() > 1) {
+                uint32_t count = first.VolumeCount();
+                std::vector<std::future<uint8_t *>> reads;
+                std::vector<size_t> sizes(count, 0);
+                sizes[0] = size;
+                for(uint32_t i = 1; i < count; ++i) {
+                    reads.push_back(std::async(std::launch::async, [&sizes, filename, i]() {
+                        return _ReadFile(VolumeFilename(filename, i), sizes[i]);
+                    }));
+                }
+                std::vector<uint8_t *> sources = { data };
+                for(auto & read : reads) {
+                    sources.push_back(read.get());
+                    volumeSources.push_back(sources.back());
+                }
+
+                bool found = std::find(sources.begin(), sources.end(), nullptr) == sources.end();
+                loaded = found && LoadFromVolumes(sources, sizes);
+                if(!loaded) {
+                    if(!found) Log("Failed to load the volumes of '" + filename + "'");
+                    for(uint8_t * source : sources) delete[] source;
+                    volumeSources.clear();
+                    data = nullptr;
+                }
+                return;
+            }
 
             // Load
-            LoadFromMemory(data);
+            LoadFromMemory(data, size);
             loaded = true;
         }
 
+        // Call back for every file whose path matches a glob pattern, such as "levels/forest/**/*.png"
+        // "**" matches any number of folders, returns false if the query was stopped by the callback
+        bool Query(const std::string & pattern, const QueryCallback & callback) {
+            if(view.valid) return view.Query(pattern, callback);
+            std::vector<std::string> segments = SplitPattern(pattern);
+            std::string path;
+            return _Query(root, segments, 0, path, callback);
+        }
+
+        // Call back for every file whose path starts with a prefix, such as "levels/forest/"
+        bool QueryPrefix(const std::string & prefix, const QueryCallback & callback) {
+            if(view.valid) return view.QueryPrefix(prefix, callback);
+
+            // Follow the complete folder names in the prefix
+            Folder * folder = &root;
+            std::string path;
+            size_t start = 0, end;
+            while(folder && (end = prefix.find('/', start)) != std::string::npos) {
+                if(end > start) {
+                    folder = folder->getFolder(prefix.substr(start, end - start));
+                    path.append(prefix, start, end - start).push_back('/');
+                }
+                start = end + 1;
+            }
+            if(folder == nullptr) return true;
+
+            // Match the remaining partial name against files and whole subtrees
+            size_t keySize = prefix.size() - start;
+            size_t length = path.size();
+            for(uint32_t i = 0; i < folder->fileCount; ++i) {
+                ShortString name = folder->files[i].name;
+                if(name.length() < keySize || memcmp(name.cStr(), prefix.data() + start, keySize) != 0) continue;
+                path.resize(length);
+                path.append(name.cStr(), name.length());
+                if(!callback(path, folder->files[i])) return false;
+            }
+            for(uint32_t i = 0; i < folder->folderCount; ++i) {
+                ShortString name = folder->folders[i].name;
+                if(name.length() < keySize || memcmp(name.cStr(), prefix.data() + start, keySize) != 0) continue;
+                path.resize(length);
+                path.append(name.cStr(), name.length()).push_back('/');
+                if(!_QueryAll(folder->folders[i], path, callback)) return false;
+            }
+            return true;
+        }
+
+        // Start warming a folder or file's payloads in the background, the future holds the bytes warmed
+        std::future<uint64_t> Prefetch(const std::string & path) {
+            if(view.valid) return view.Prefetch(path);
+
+            // Find the folder or file
+            Folder * folder = &root;
+            File * file = nullptr;
+            size_t start = 0;
+            while(folder && start < path.size()) {
+                size_t end = path.find('/', start);
+                if(end == std::string::npos) end = path.size();
+                if(end > start) {
+                    std::string name = path.substr(start, end - start);
+                    file = end == path.size() ? folder->getFile(name) : nullptr;
+                    folder = file ? nullptr : folder->getFolder(name);
+                }
+                start = end + 1;
+            }
+            if(folder == nullptr && file == nullptr) {
+                Log("Failed to find prefetch path '" + path + "'");
+                return EmptyPrefetch();
+            }
+
+            // Collect payload ranges
+            std::vector<Range> ranges;
+            auto collect = [&](auto self, Folder & current) -> void {
+                for(uint32_t i = 0; i < current.fileCount; ++i)
+                    ranges.push_back({ (uint64_t)(current.files[i].data - fileData), current.files[i].size });
+                for(uint32_t i = 0; i < current.folderCount; ++i)
+                    self(self, current.folders[i]);
+            };
+            if(file) ranges.push_back({ (uint64_t)(file->data - fileData), file->size });
+            else collect(collect, *folder);
+            return StartPrefetch(fileData, std::move(ranges), false);
+        }
+
         // Dump the directory structure to log
         void Dump() {
             // Define lambda for recursive folder dumping
@@ -256,7 +1088,547 @@ namespace Muckrat {
 
             root.Unload();
             delete[] data;
+            for(uint8_t * source : volumeSources) delete[] source;
         }
     };
 
+    // FNV-1a hash of a block of data
+    inline uint64_t Hash(const uint8_t * data, size_t size) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for(size_t i = 0; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    // Builds a version 2 package in memory from buffers, without touching the filesystem
+    class PackageBuilder {
+        private:
+        struct BuildFile {
+            std::vector<uint8_t> owned;     // Data owned by the builder
+            const uint8_t * data = nullptr;
+            size_t size = 0;
+        };
+        struct BuildFolder {
+            std::map<std::string, uint32_t> folders;    // Subfolder indices, sorted by name
+            std::map<std::string, uint32_t> files;      // File indices, sorted by name
+        };
+
+        char id[4] = { 'M', 'P', 'A', 'K' };
+        std::string rootName;
+        std::vector<BuildFolder> folders;
+        std::vector<BuildFile> files;
+
+        // Get the file slot for a path, creating its folders
+        BuildFile * _Slot(const std::string & path) {
+            uint32_t folder = 0;
+            size_t start = 0, end;
+            while((end = path.find('/', start)) != std::string::npos) {
+                if(end > start) {
+                    std::string name = path.substr(start, end - start);
+                    auto found = folders[folder].folders.find(name);
+                    if(found == folders[folder].folders.end()) {
+                        uint32_t index = folders.size();
+                        folders[folder].folders.emplace(name, index);
+                        folders.emplace_back();
+                        folder = index;
+                    }
+                    else folder = found->second;
+                }
+                start = end + 1;
+            }
+
+            std::string name = path.substr(start);
+            if(name.empty() || name.size() > 255 || rootName.size() > 255) {
+                Log("Invalid package path '" + path + "'");
+                return nullptr;
+            }
+            auto found = folders[folder].files.find(name);
+            if(found != folders[folder].files.end())
+                return &files[found->second];   // Replace the existing file
+            folders[folder].files.emplace(name, (uint32_t)files.size());
+            files.emplace_back();
+            return &files.back();
+        }
+
+        // Folder indices breadth first, with each folder's children contiguous and sorted
+        std::vector<uint32_t> _FolderOrder() const {
+            std::vector<uint32_t> order = { 0 };
+            for(size_t i = 0; i < order.size(); ++i) {
+                for(auto & child : folders[order[i]].folders)
+                    order.push_back(child.second);
+            }
+            return order;
+        }
+
+        // Write the header and table of contents, padded up to the data section
+        std::vector<uint8_t> _BuildToc() const {
+            std::vector<uint32_t> order = _FolderOrder();
+
+            // Size everything up front so the table is allocated once
+            size_t stringsSize = rootName.size() + 2;
+            uint64_t dataSize = 0;
+            for(uint32_t index : order) {
+                for(auto & child : folders[index].folders) stringsSize += child.first.size() + 2;
+                for(auto & child : folders[index].files) {
+                    stringsSize += child.first.size() + 2;
+                    dataSize += files[child.second].size;
+                }
+            }
+            stringsSize = (stringsSize + 7) & ~(size_t)7;
+            uint64_t tocSize = sizeof(FolderRecord) * order.size() + sizeof(FileRecord) * files.size() + stringsSize;
+            uint64_t dataOffset = (sizeof(ArchiveHeader) + tocSize + 15) & ~(uint64_t)15;
+
+            std::vector<uint8_t> toc(dataOffset, 0);
+            ArchiveHeader * header = (ArchiveHeader *)toc.data();
+            memcpy(header->id, id, 4);
+            memset(header->marker, 0xFF, sizeof(header->marker));
+            header->version = FromLE(VERSION_2);
+            header->tocOffset = FromLE((uint64_t)sizeof(ArchiveHeader));
+            header->tocSize = FromLE(tocSize);
+            header->dataOffset = FromLE(dataOffset);
+            header->dataSize = FromLE(dataSize);
+            header->folderCount = FromLE((uint32_t)order.size());
+            header->fileCount = FromLE((uint32_t)files.size());
+
+            FolderRecord * folderRecords = (FolderRecord *)(toc.data() + sizeof(ArchiveHeader));
+            FileRecord * fileRecords = (FileRecord *)(folderRecords + order.size());
+            uint8_t * strings = (uint8_t *)(fileRecords + files.size());
+            uint32_t stringOffset = 0;
+            auto writeString = [&](const std::string & name) {
+                uint32_t start = stringOffset;
+                strings[start] = (uint8_t)name.size();
+                memcpy(strings + start + 1, name.data(), name.size());
+                stringOffset += name.size() + 2;
+                return FromLE(start);
+            };
+
+            // Files are laid out in record order so the data can be streamed after the table
+            folderRecords[0].name = writeString(rootName);
+            folderRecords[0].parent = FromLE(NO_PARENT);
+            uint32_t nextFolder = 1, nextFile = 0;
+            uint64_t offset = 0;
+            for(size_t i = 0; i < order.size(); ++i) {
+                const BuildFolder & folder = folders[order[i]];
+                FolderRecord & record = folderRecords[i];
+                record.firstFolder = FromLE(nextFolder);
+                record.folderCount = FromLE((uint32_t)folder.folders.size());
+                record.firstFile = FromLE(nextFile);
+                record.fileCount = FromLE((uint32_t)folder.files.size());
+                for(auto & child : folder.folders) {
+                    folderRecords[nextFolder].name = writeString(child.first);
+                    folderRecords[nextFolder++].parent = FromLE((uint32_t)i);
+                }
+                for(auto & child : folder.files) {
+                    const BuildFile & file = files[child.second];
+                    FileRecord & fileRecord = fileRecords[nextFile++];
+                    fileRecord.name = writeString(child.first);
+                    fileRecord.size = FromLE((uint64_t)file.size);
+                    fileRecord.offset = FromLE(offset);
+                    fileRecord.hash = FromLE(Hash(file.data, file.size));
+                    offset += file.size;
+                }
+            }
+            return toc;
+        }
+
+        // Call a function for each file's data in archive order
+        template<typename Function>
+        bool _EachFile(Function function) const {
+            for(uint32_t index : _FolderOrder()) {
+                for(auto & child : folders[index].files) {
+                    if(!function(files[child.second])) return false;
+                }
+            }
+            return true;
+        }
+
+        public:
+        PackageBuilder(std::string rootName = "") : rootName(rootName) {
+            folders.emplace_back();
+        }
+
+        // Set the optional 4 character package id
+        void SetId(const char * newId) {
+            memset(id, 0, 4);
+            memcpy(id, newId, strnlen(newId, 4));
+        }
+
+        // Pre-size for an expected number of files and folders
+        void Reserve(size_t fileCount, size_t folderCount = 0) {
+            files.reserve(fileCount);
+            folders.reserve(folderCount + 1);
+        }
+
+        // Add a file, copying its data
+        bool AddFile(const std::string & path, const void * data, size_t size) {
+            BuildFile * file = _Slot(path);
+            if(file == nullptr) return false;
+            file->owned.assign((const uint8_t *)data, (const uint8_t *)data + size);
+            file->data = file->owned.data();
+            file->size = size;
+            return true;
+        }
+
+        // Add a file, taking its data without copying
+        bool AddFile(const std::string & path, std::vector<uint8_t> && data) {
+            BuildFile * file = _Slot(path);
+            if(file == nullptr) return false;
+            file->owned = std::move(data);
+            file->data = file->owned.data();
+            file->size = file->owned.size();
+            return true;
+        }
+
+        // Add a file that references data owned by the caller, which must outlive the builder
+        bool AddFileReference(const std::string & path, const void * data, size_t size) {
+            BuildFile * file = _Slot(path);
+            if(file == nullptr) return false;
+            file->owned.clear();
+            file->data = (const uint8_t *)data;
+            file->size = size;
+            return true;
+        }
+
+        // Build the archive in memory
+        std::vector<uint8_t> Build() const {
+            std::vector<uint8_t> archive = _BuildToc();
+            const ArchiveHeader * header = (const ArchiveHeader *)archive.data();
+            size_t offset = archive.size();
+            archive.resize(offset + FromLE(header->dataSize));
+            _EachFile([&](const BuildFile & file) {
+                if(file.size) memcpy(archive.data() + offset, file.data, file.size);
+                offset += file.size;
+                return true;
+            });
+            return archive;
+        }
+
+        // Stream the archive to an output stream in one pass
+        bool Write(std::ostream & out) const {
+            std::vector<uint8_t> toc = _BuildToc();
+            out.write((const char *)toc.data(), toc.size());
+            return _EachFile([&](const BuildFile & file) {
+                out.write((const char *)file.data, file.size);
+                return (bool)out;
+            }) && (bool)out;
+        }
+
+        #ifndef _WIN32
+        // Stream the archive to a file descriptor in one pass
+        bool Write(int fd) const {
+            auto writeAll = [fd](const uint8_t * data, size_t size) {
+                while(size > 0) {
+                    ssize_t written = write(fd, data, size);
+                    if(written < 0) return false;
+                    data += written;
+                    size -= written;
+                }
+                return true;
+            };
+            std::vector<uint8_t> toc = _BuildToc();
+            if(!writeAll(toc.data(), toc.size())) return false;
+            return _EachFile([&](const BuildFile & file) {
+                return writeAll(file.data, file.size);
+            });
+        }
+        #endif
+    };
+
+    #ifdef MUCKPAK_MMAP
+    const uint32_t INDEX_VERSION = 1;
+
+    // Index file header, identifies the exact archive the index was built from
+    struct IndexHeader {
+        char id[4];             // "MIDX"
+        uint32_t version;
+        uint32_t format;        // Archive format version of the index
+        uint32_t reserved;
+        uint64_t archiveSize;
+        uint64_t archiveMtime;
+        uint64_t archiveInode;
+        uint64_t archiveDevice;
+        uint64_t dataOffset;    // Offset of the file data in the archive
+        uint64_t dataSize;
+    };
+
+    // Package mapped shared and read only, every process mapping the same archive shares one copy
+    // of its data and index. Version 2 archives are their own index, version 1 archives get an
+    // index file (<archive>.idx) built by the first process and attached to by the rest.
+    class MappedPackage {
+        private:
+        uint8_t * map = nullptr;    // Mapped archive
+        size_t mapSize = 0;
+        uint8_t * index = nullptr;  // Mapped index file (version 1 archives only)
+        size_t indexSize = 0;
+        std::vector<uint8_t> indexCopy; // Index built in memory when the index file can't be written
+        std::vector<uint8_t *> volumeMaps;  // Volumes of a multi-volume archive after the first
+        std::vector<size_t> volumeSizes;
+        std::vector<uint8_t *> volumeData;  // File data of every volume
+
+        // Map a whole file shared and read only
+        static uint8_t * _MapFile(const std::string & filename, size_t & size, struct stat & st) {
+            int fd = open(filename.c_str(), O_RDONLY);
+            if(fd < 0) return nullptr;
+            if(fstat(fd, &st) != 0 || st.st_size == 0) {
+                close(fd);
+                return nullptr;
+            }
+            void * mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if(mapping == MAP_FAILED) return nullptr;
+            size = st.st_size;
+            return (uint8_t *)mapping;
+        }
+
+        // Identity of an archive for its index
+        static IndexHeader _Identity(const struct stat & st) {
+            IndexHeader header = {};
+            memcpy(header.id, "MIDX", 4);
+            header.version = FromLE(INDEX_VERSION);
+            header.format = FromLE(VERSION_2);
+            header.archiveSize = FromLE((uint64_t)st.st_size);
+            uint64_t mtime = (uint64_t)st.st_mtime * 1000000000ull;
+            #ifdef __linux__
+            mtime += st.st_mtim.tv_nsec;
+            #endif
+            header.archiveMtime = FromLE(mtime);
+            header.archiveInode = FromLE((uint64_t)st.st_ino);
+            header.archiveDevice = FromLE((uint64_t)st.st_dev);
+            return header;
+        }
+
+        // Check an index file belongs to an archive
+        static bool _Matches(const uint8_t * source, size_t size, const IndexHeader & identity) {
+            if(size < sizeof(IndexHeader)) return false;
+            const IndexHeader * header = (const IndexHeader *)source;
+            return memcmp(header->id, identity.id, 4) == 0 && header->version == identity.version && header->format == identity.format
+                && header->archiveSize == identity.archiveSize && header->archiveMtime == identity.archiveMtime
+                && header->archiveInode == identity.archiveInode && header->archiveDevice == identity.archiveDevice;
+        }
+
+        // Build the index of a version 1 archive in memory
+        bool _BuildIndex(const std::string & indexFilename, IndexHeader identity, std::vector<uint8_t> & out) {
+            uint64_t structSize, archiveDataSize;
+            memcpy(&structSize, map + 4, 8);
+            memcpy(&archiveDataSize, map + 12, 8);
+            if(structSize > mapSize || archiveDataSize > mapSize - structSize) return false;
+            uint8_t * fileData = map + structSize;
+
+            // Parse the version 1 structure straight from the mapping
+            Package parsed;
+            parsed.LoadFromMemory(map, mapSize);
+
+            // Order folders breadth first so the children of each folder are contiguous
+            auto byName = [](ShortString a, ShortString b) {
+                int result = memcmp(a.cStr(), b.cStr(), std::min(a.length(), b.length()));
+                return result ? result < 0 : a.length() < b.length();
+            };
+            std::vector<Folder *> folders = { &parsed.root };
+            size_t fileCount = 0, stringsSize = parsed.root.name.length() + 2;
+            for(size_t i = 0; i < folders.size(); ++i) {
+                Folder * folder = folders[i];
+                size_t first = folders.size();
+                for(uint32_t j = 0; j < folder->folderCount; ++j) {
+                    folders.push_back(&folder->folders[j]);
+                    stringsSize += folder->folders[j].name.length() + 2;
+                }
+                std::sort(folders.begin() + first, folders.end(), [&](Folder * a, Folder * b) { return byName(a->name, b->name); });
+                for(uint32_t j = 0; j < folder->fileCount; ++j)
+                    stringsSize += folder->files[j].name.length() + 2;
+                fileCount += folder->fileCount;
+            }
+            stringsSize = (stringsSize + 7) & ~(size_t)7;
+
+            // Lay out the index
+            ArchiveHeader header = {};
+            memcpy(header.id, map, 4);
+            memset(header.marker, 0xFF, sizeof(header.marker));
+            uint64_t tocSize = sizeof(FolderRecord) * folders.size() + sizeof(FileRecord) * fileCount + stringsSize;
+            header.version = FromLE(VERSION_2);
+            header.tocOffset = FromLE((uint64_t)sizeof(ArchiveHeader));
+            header.tocSize = FromLE(tocSize);
+            header.dataOffset = FromLE((sizeof(ArchiveHeader) + tocSize + 15) & ~(uint64_t)15);
+            header.dataSize = FromLE(archiveDataSize);
+            header.folderCount = FromLE((uint32_t)folders.size());
+            header.fileCount = FromLE((uint32_t)fileCount);
+            identity.dataOffset = FromLE(structSize);
+            identity.dataSize = FromLE(archiveDataSize);
+
+            // Records are placed by byte offset into the buffer
+            size_t foldersStart = sizeof(IndexHeader) + sizeof(ArchiveHeader);
+            size_t filesStart = foldersStart + sizeof(FolderRecord) * folders.size();
+            size_t stringsStart = filesStart + sizeof(FileRecord) * fileCount;
+            out.assign(stringsStart + stringsSize, 0);
+            std::copy((const uint8_t *)&identity, (const uint8_t *)(&identity + 1), out.begin());
+            std::copy((const uint8_t *)&header, (const uint8_t *)(&header + 1), out.begin() + sizeof(IndexHeader));
+            FolderRecord * folderRecords = (FolderRecord *)(out.data() + foldersStart);
+            FileRecord * fileRecords = (FileRecord *)(out.data() + filesStart);
+            uint32_t stringOffset = 0;
+            bool stringsFit = true;
+            auto writeString = [&](ShortString name) {
+                uint32_t start = stringOffset;
+                size_t length = name.length();
+                if(start + length + 2 > stringsSize) {
+                    stringsFit = false;
+                    return FromLE(start);
+                }
+                std::copy(name.content, name.content + length + 1, out.begin() + stringsStart + start);
+                out[stringsStart + start + 1 + length] = '\0';
+                stringOffset += length + 2;
+                return FromLE(start);
+            };
+
+            // Write records
+            folderRecords[0].name = writeString(parsed.root.name);
+            folderRecords[0].parent = FromLE(NO_PARENT);
+            uint32_t nextFolder = 1, nextFile = 0;
+            for(size_t i = 0; i < folders.size(); ++i) {
+                Folder * folder = folders[i];
+                folderRecords[i].firstFolder = FromLE(nextFolder);
+                folderRecords[i].folderCount = FromLE(folder->folderCount);
+                folderRecords[i].firstFile = FromLE(nextFile);
+                folderRecords[i].fileCount = FromLE(folder->fileCount);
+                for(uint32_t j = 0; j < folder->folderCount; ++j) {
+                    folderRecords[nextFolder + j].name = writeString(folders[nextFolder + j]->name);
+                    folderRecords[nextFolder + j].parent = FromLE((uint32_t)i);
+                }
+                nextFolder += folder->folderCount;
+
+                std::vector<File *> files;
+                for(uint32_t j = 0; j < folder->fileCount; ++j) files.push_back(&folder->files[j]);
+                std::sort(files.begin(), files.end(), [&](File * a, File * b) { return byName(a->name, b->name); });
+                for(File * file : files) {
+                    FileRecord & record = fileRecords[nextFile++];
+                    record.name = writeString(file->name);
+                    record.size = FromLE((uint64_t)file->size);
+                    record.offset = FromLE((uint64_t)(file->data - fileData));
+                }
+            }
+            parsed.root.Unload();
+            if(!stringsFit) {
+                Log(std::string("Failed to build index, string table overflow: ") + indexFilename);
+                return false;
+            }
+            return true;
+        }
+
+        // Write an index file, written to a temporary file then renamed into place
+        static bool _WriteIndex(const std::string & indexFilename, const std::vector<uint8_t> & out) {
+            // Write it next to the final name so the rename is atomic
+            std::string tempFilename = indexFilename + "." + std::to_string(getpid()) + ".tmp";
+            std::fstream file(tempFilename, std::ios::out | std::ios::binary | std::ios::trunc);
+            file.write((const char *)out.data(), out.size());
+            file.close();
+            if(!file || rename(tempFilename.c_str(), indexFilename.c_str()) != 0) {
+                remove(tempFilename.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        // Open the view of a version 1 archive through its index
+        bool _AttachIndex(uint8_t * source, size_t size) {
+            const IndexHeader * header = (const IndexHeader *)source;
+            uint64_t dataOffset = FromLE(header->dataOffset), dataSize = FromLE(header->dataSize);
+            return dataOffset <= mapSize && dataSize <= mapSize - dataOffset
+                && view.OpenIndex(source + sizeof(IndexHeader), size - sizeof(IndexHeader), map + dataOffset);
+        }
+
+        // Map the rest of a multi-volume archive's volumes
+        bool _MapVolumes(const std::string & filename) {
+            uint32_t count = view.VolumeCount();
+            if(count == 1) return true;
+            volumeData = { map + FromLE(view.Header()->dataOffset) };
+            for(uint32_t i = 1; i < count; ++i) {
+                struct stat st;
+                size_t size = 0;
+                uint8_t * volume = _MapFile(VolumeFilename(filename, i), size, st);
+                if(volume == nullptr) return false;
+                volumeMaps.push_back(volume);
+                volumeSizes.push_back(size);
+                volumeData.push_back(view.VolumeData(volume, size, i));
+                if(volumeData.back() == nullptr) return false;
+            }
+            view.SetVolumes(volumeData.data());
+            return true;
+        }
+
+        public:
+        bool loaded = false;
+        PackageView view;   // In place view of the archive
+
+        // Map a package, for multi-volume archives this is the first volume
+        MappedPackage(std::string filename) {
+            struct stat st;
+            map = _MapFile(filename, mapSize, st);
+            if(map == nullptr) {
+                Log("Failed to map file '" + filename + "'");
+                return;
+            }
+
+            // Version 2 archives are queried in place
+            if(view.Open(map, mapSize)) {
+                loaded = _MapVolumes(filename);
+                if(!loaded) Log("Failed to map the volumes of '" + filename + "'");
+                return;
+            }
+
+            // Version 1 archives use an index file, rebuilt if it is missing or stale
+            // If it can't be written (a read only location) the index is kept in this process instead
+            IndexHeader identity = _Identity(st);
+            std::string indexFilename = filename + ".idx";
+            for(int attempt = 0; attempt < 2 && !loaded; ++attempt) {
+                struct stat indexSt;
+                index = _MapFile(indexFilename, indexSize, indexSt);
+                if(index && _Matches(index, indexSize, identity) && _AttachIndex(index, indexSize)) {
+                    loaded = true;
+                    break;
+                }
+                if(index) munmap(index, indexSize);
+                index = nullptr;
+                if(attempt == 1) break;
+
+                std::vector<uint8_t> built;
+                if(!_BuildIndex(indexFilename, identity, built)) break;
+                if(_WriteIndex(indexFilename, built)) continue;
+                indexCopy = std::move(built);
+                loaded = _AttachIndex(indexCopy.data(), indexCopy.size());
+            }
+            if(!loaded) Log("Failed to index file '" + filename + "'");
+        }
+
+        MappedPackage(const MappedPackage &) = delete;
+        MappedPackage & operator = (const MappedPackage &) = delete;
+
+        // Get a file from a path
+        File getFile(std::string path) {
+            return view.getFile(path);
+        }
+
+        // Call back for every file whose path matches a glob pattern
+        bool Query(const std::string & pattern, const QueryCallback & callback) {
+            return view.Query(pattern, callback);
+        }
+
+        // Call back for every file whose path starts with a prefix
+        bool QueryPrefix(const std::string & prefix, const QueryCallback & callback) {
+            return view.QueryPrefix(prefix, callback);
+        }
+
+        // Start warming a folder or file's payloads in the background, the future holds the bytes warmed
+        std::future<uint64_t> Prefetch(const std::string & path) {
+            return view.Prefetch(path, true);
+        }
+
+        ~MappedPackage() {
+            if(map) munmap(map, mapSize);
+            if(index) munmap(index, indexSize);
+            for(size_t i = 0; i < volumeMaps.size(); ++i)
+                munmap(volumeMaps[i], volumeSizes[i]);
+        }
+    };
+    #endif
+
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+/* Checks that incremental builds don't re-hash unchanged files */
+/* Build and run from the repository root: cc -x c++ -I. tests/build_cache.c -o build_cache && ./build_cache */
+
+#define MUCKPAK_CREATE_ARCHIVE
+#include <muckpak.h>
+#include <fcntl.h>
+
+#define TEST_FOLDER "build_cache_test"
+#define TEST_ARCHIVE TEST_FOLDER ".mpak"
+#define TEST_CACHE TEST_FOLDER ".mpak.cache"
+
+int failures = 0;
+
+#define CHECK(condition) do { \
+    if(!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while(0)
+
+void write_file(const char * path, const char * text) {
+    FILE * f = fopen(path, "wb");
+    fputs(text, f);
+    fclose(f);
+}
+
+// Build the test folder with its cache, like the command line tool does
+m_build_cache build() {
+    m_build_cache cache = load_build_cache(TEST_CACHE, TEST_ARCHIVE);
+    package pkg = load_package_folder_cached(TEST_FOLDER, &cache);
+    save_package_to_archive_cached(TEST_ARCHIVE, pkg, &cache);
+    save_build_cache(TEST_CACHE, TEST_ARCHIVE, &cache);
+    free_package(pkg);
+    return cache;
+}
+
+// Check every file record's hash against its payload
+void check_hashes() {
+    archive arc = load_archive(TEST_ARCHIVE);
+    m_view view;
+    CHECK(open_view(arc.data, arc.size, &view));
+    for(uint32_t i = 0; i < m_le32(view.header->file_count); ++i) {
+        const m_file_record * record = &view.files[i];
+        CHECK(m_le64(record->hash) == m_hash(view.data + m_le64(record->offset), m_le64(record->size)));
+    }
+    free(arc.data);
+}
+
+int main() {
+    mkdir(TEST_FOLDER, 0755);
+    mkdir(TEST_FOLDER "/sub", 0755);
+    write_file(TEST_FOLDER "/a.txt", "first file");
+    write_file(TEST_FOLDER "/b.txt", "second file");
+    write_file(TEST_FOLDER "/sub/c.txt", "third file");
+    remove(TEST_CACHE);
+
+    // A clean build hashes everything once
+    m_build_cache cache = build();
+    CHECK(cache.loaded == 3 && cache.reused == 0 && cache.hashed == 3);
+    free_build_cache(cache);
+    check_hashes();
+
+    // Nothing changed, so nothing is read or hashed
+    cache = build();
+    CHECK(cache.loaded == 0 && cache.reused == 3 && cache.hashed == 0);
+    free_build_cache(cache);
+    check_hashes();
+
+    // Only the changed file is hashed
+    write_file(TEST_FOLDER "/b.txt", "second file, changed");
+    cache = build();
+    CHECK(cache.loaded == 1 && cache.reused == 2 && cache.hashed == 1);
+    free_build_cache(cache);
+    check_hashes();
+
+    // An archive rewritten with other content of the same size and modification time isn't trusted
+    struct stat st;
+    stat(TEST_ARCHIVE, &st);
+    write_file(TEST_FOLDER "/a.txt", "first_file");
+    package pkg = load_package_folder(TEST_FOLDER);
+    save_package_to_archive(TEST_ARCHIVE, pkg);
+    free_package(pkg);
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    utimensat(AT_FDCWD, TEST_ARCHIVE, times, 0);
+    write_file(TEST_FOLDER "/a.txt", "first file");
+    cache = load_build_cache(TEST_CACHE, TEST_ARCHIVE);
+    CHECK(cache.archive == NULL);
+    free_build_cache(cache);
+    cache = build();
+    CHECK(cache.loaded == 3 && cache.reused == 0);
+    free_build_cache(cache);
+    check_hashes();
+
+    remove(TEST_FOLDER "/a.txt");
+    remove(TEST_FOLDER "/b.txt");
+    remove(TEST_FOLDER "/sub/c.txt");
+    rmdir(TEST_FOLDER "/sub");
+    rmdir(TEST_FOLDER);
+    remove(TEST_ARCHIVE);
+    remove(TEST_CACHE);
+
+    if(failures) return 1;
+    printf("build_cache: passed\n");
+    return 0;
+}
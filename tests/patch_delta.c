@@ -0,0 +1,73 @@
+/* Checks that patches between repetitive archives are quick to create and rebuild the new archive */
+/* Build and run from the repository root: cc -x c++ -I. tests/patch_delta.c -o patch_delta && ./patch_delta */
+
+#define MUCKPAK_CREATE_ARCHIVE
+#include <muckpak.h>
+#include <time.h>
+
+#define TEST_FOLDER "patch_delta_test"
+#define OLD_ARCHIVE TEST_FOLDER ".old.mpak"
+#define NEW_ARCHIVE TEST_FOLDER ".new.mpak"
+#define OUT_ARCHIVE TEST_FOLDER ".out.mpak"
+#define TEST_PATCH TEST_FOLDER ".patch"
+#define RUN_SIZE (4 << 20)
+
+int failures = 0;
+
+#define CHECK(condition) do { \
+    if(!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while(0)
+
+// Write a file of identical bytes, optionally starting with a different prefix
+void write_run(const char * path, const char * prefix) {
+    uint8_t * data = (uint8_t *)calloc(RUN_SIZE, 1);
+    FILE * f = fopen(path, "wb");
+    fputs(prefix, f);
+    fwrite(data, 1, RUN_SIZE, f);
+    fclose(f);
+    free(data);
+}
+
+void pack(const char * archive_filename) {
+    package pkg = load_package_folder(TEST_FOLDER);
+    save_package_to_archive(archive_filename, pkg);
+    free_package(pkg);
+}
+
+int main() {
+    mkdir(TEST_FOLDER, 0755);
+    write_run(TEST_FOLDER "/zeros.bin", "");
+    pack(OLD_ARCHIVE);
+    write_run(TEST_FOLDER "/zeros.bin", "x");
+    pack(NEW_ARCHIVE);
+
+    // A long run of one byte lands every block in the same hash bucket
+    clock_t start = clock();
+    CHECK(diff_archives(OLD_ARCHIVE, NEW_ARCHIVE, TEST_PATCH));
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    CHECK(seconds < 5.0);
+
+    // The run is copied from the old archive rather than stored in the patch
+    CHECK(_m_file_size(TEST_PATCH) < 4096);
+
+    CHECK(apply_patch(OLD_ARCHIVE, TEST_PATCH, OUT_ARCHIVE));
+    archive expected = load_archive(NEW_ARCHIVE);
+    archive patched = load_archive(OUT_ARCHIVE);
+    CHECK(patched.data && patched.size == expected.size && memcmp(patched.data, expected.data, expected.size) == 0);
+    free(expected.data);
+    free(patched.data);
+
+    remove(TEST_FOLDER "/zeros.bin");
+    rmdir(TEST_FOLDER);
+    remove(OLD_ARCHIVE);
+    remove(NEW_ARCHIVE);
+    remove(OUT_ARCHIVE);
+    remove(TEST_PATCH);
+
+    if(failures) return 1;
+    printf("patch_delta: passed\n");
+    return 0;
+}
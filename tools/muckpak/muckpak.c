@@ -3,7 +3,189 @@
 #define MUCKPAK_CREATE_ARCHIVE
 #include <muckpak.h>
 
+// Format a byte count in the largest unit that divides it
+void format_bytes(char * out, size_t size, uint64_t bytes) {
+    if(bytes >= 1048576 && bytes % 1048576 == 0) snprintf(out, size, "%llu MB", (unsigned long long)(bytes / 1048576));
+    else if(bytes >= 1024 && bytes % 1024 == 0) snprintf(out, size, "%llu KB", (unsigned long long)(bytes / 1024));
+    else snprintf(out, size, "%llu B", (unsigned long long)bytes);
+}
+
+// Print a JSON string with escapes
+void print_json_string(const char * str) {
+    putchar('"');
+    for(; *str; ++str) {
+        unsigned char c = (unsigned char)*str;
+        if(c == '"' || c == '\\') printf("\\%c", c);
+        else if(c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+void print_analysis(const char * filename, const m_analysis * analysis) {
+    printf("Archive: %s (version %u, %u volume%s)\n", filename, analysis->version, analysis->volume_count, analysis->volume_count == 1 ? "" : "s");
+    printf("Size: %llu bytes (table of contents %llu bytes, data %llu bytes, table %.2f%% of data)\n",
+        (unsigned long long)analysis->archive_size, (unsigned long long)analysis->toc_size, (unsigned long long)analysis->data_size,
+        analysis->data_size ? 100.0 * analysis->toc_size / analysis->data_size : 0.0);
+    printf("Folders: %lu, files: %lu\n", analysis->folder_count, analysis->file_count);
+
+    printf("\nFolder fan-out (files and subfolders per folder): mean %.2f, max %lu in /%s\n", analysis->mean_fanout, analysis->max_fanout, analysis->max_fanout_path);
+    for(unsigned int i = 0; i < M_ANALYSIS_BUCKETS; ++i) {
+        char label[64];
+        if(i == M_ANALYSIS_BUCKETS - 1) snprintf(label, sizeof(label), "> %llu", (unsigned long long)m_fanout_limits[i - 1]);
+        else if(i == 0 || m_fanout_limits[i - 1] + 1 == m_fanout_limits[i]) snprintf(label, sizeof(label), "%llu", (unsigned long long)m_fanout_limits[i]);
+        else snprintf(label, sizeof(label), "%llu-%llu", (unsigned long long)m_fanout_limits[i - 1] + 1, (unsigned long long)m_fanout_limits[i]);
+        printf("  %-12s %lu folders\n", label, analysis->fanout[i]);
+    }
+
+    printf("\nFile sizes:\n");
+    for(unsigned int i = 0; i < M_ANALYSIS_BUCKETS; ++i) {
+        char bytes[32], label[64];
+        format_bytes(bytes, sizeof(bytes), i == 0 ? 0 : i == M_ANALYSIS_BUCKETS - 1 ? m_size_limits[i - 1] + 1 : m_size_limits[i] + 1);
+        snprintf(label, sizeof(label), "%s%s", i == 0 ? "" : i == M_ANALYSIS_BUCKETS - 1 ? ">= " : "< ", bytes);
+        printf("  %-12s %lu files, %llu bytes\n", label, analysis->sizes[i], (unsigned long long)analysis->size_bytes[i]);
+    }
+
+    printf("\nDuplicate content: %lu files, %llu bytes\n", analysis->duplicate_files, (unsigned long long)analysis->duplicate_bytes);
+    printf("Misaligned payloads: %lu not %d byte aligned (%llu bytes), %lu of a page or more not page aligned\n",
+        analysis->misaligned, M_V2_ALIGN, (unsigned long long)analysis->misaligned_bytes, analysis->unaligned_pages);
+
+    printf("\nAverage name comparisons per lookup:\n");
+    printf("  Folder scan:    hit %.2f, miss %.2f\n", analysis->linear_hit, analysis->linear_miss);
+    if(analysis->version == M_VERSION_2)
+        printf("  Binary search:  hit %.2f, miss %.2f\n", analysis->binary_hit, analysis->binary_miss);
+}
+
+void print_analysis_json(const char * filename, const m_analysis * analysis) {
+    printf("{\n  \"archive\": ");
+    print_json_string(filename);
+    printf(",\n  \"version\": %u,\n  \"volumes\": %u,\n", analysis->version, analysis->volume_count);
+    printf("  \"archive_size\": %llu,\n  \"toc_size\": %llu,\n  \"data_size\": %llu,\n",
+        (unsigned long long)analysis->archive_size, (unsigned long long)analysis->toc_size, (unsigned long long)analysis->data_size);
+    printf("  \"folders\": %lu,\n  \"files\": %lu,\n", analysis->folder_count, analysis->file_count);
+
+    printf("  \"fanout\": {\n    \"mean\": %.4f,\n    \"max\": %lu,\n    \"max_path\": ", analysis->mean_fanout, analysis->max_fanout);
+    print_json_string(analysis->max_fanout_path);
+    printf(",\n    \"buckets\": [");
+    for(unsigned int i = 0; i < M_ANALYSIS_BUCKETS; ++i) {
+        printf("%s\n      { \"max\": ", i ? "," : "");
+        if(i == M_ANALYSIS_BUCKETS - 1) printf("null");
+        else printf("%llu", (unsigned long long)m_fanout_limits[i]);
+        printf(", \"folders\": %lu }", analysis->fanout[i]);
+    }
+    printf("\n    ]\n  },\n");
+
+    printf("  \"sizes\": [");
+    for(unsigned int i = 0; i < M_ANALYSIS_BUCKETS; ++i) {
+        printf("%s\n    { \"max\": ", i ? "," : "");
+        if(i == M_ANALYSIS_BUCKETS - 1) printf("null");
+        else printf("%llu", (unsigned long long)m_size_limits[i]);
+        printf(", \"files\": %lu, \"bytes\": %llu }", analysis->sizes[i], (unsigned long long)analysis->size_bytes[i]);
+    }
+    printf("\n  ],\n");
+
+    printf("  \"duplicates\": { \"files\": %lu, \"bytes\": %llu },\n", analysis->duplicate_files, (unsigned long long)analysis->duplicate_bytes);
+    printf("  \"misaligned\": { \"alignment\": %d, \"files\": %lu, \"bytes\": %llu, \"unaligned_pages\": %lu },\n",
+        M_V2_ALIGN, analysis->misaligned, (unsigned long long)analysis->misaligned_bytes, analysis->unaligned_pages);
+    printf("  \"lookup\": {\n    \"linear\": { \"hit\": %.4f, \"miss\": %.4f },\n", analysis->linear_hit, analysis->linear_miss);
+    if(analysis->version == M_VERSION_2)
+        printf("    \"binary\": { \"hit\": %.4f, \"miss\": %.4f }\n", analysis->binary_hit, analysis->binary_miss);
+    else
+        printf("    \"binary\": null\n");
+    printf("  }\n}\n");
+}
+
 int main(int argc, char * argv[]) {
+    // Create a patch between two archives
+    if(argc == 5 && strcmp(argv[1], "diff") == 0) {
+        if(!diff_archives(argv[2], argv[3], argv[4])) {
+            fprintf(stderr, "Failed to create patch %s\n", argv[4]);
+            return 1;
+        }
+        printf("Patch created: %s\n", argv[4]);
+        return 0;
+    }
+
+    // Apply a patch to an archive
+    if(argc == 5 && strcmp(argv[1], "patch") == 0) {
+        if(!apply_patch(argv[2], argv[3], argv[4])) {
+            fprintf(stderr, "Failed to apply patch %s\n", argv[3]);
+            return 1;
+        }
+        printf("Package patched: %s\n", argv[4]);
+        return 0;
+    }
+
+    // Import a tar stream ("-" for stdin) straight into an archive
+    if((argc == 4 || argc == 5) && strcmp(argv[1], "--from-tar") == 0) {
+        FILE * tar = strcmp(argv[2], "-") == 0 ? stdin : fopen(argv[2], "rb");
+        if(!tar) {
+            perror("Failed to open tar file");
+            return 1;
+        }
+        unsigned long file_count = 0;
+        bool success = import_tar(tar, argv[3], argc == 5 ? argv[4] : NULL, &file_count);
+        if(tar != stdin) fclose(tar);
+        if(!success) {
+            fprintf(stderr, "Failed to import %s\n", argv[2]);
+            return 1;
+        }
+        printf("Package created: %s (%lu files imported)\n", argv[3], file_count);
+        return 0;
+    }
+
+    // Pack a folder into volumes of a maximum size
+    if((argc == 4 || argc == 5) && strcmp(argv[1], "volumes") == 0) {
+        char * end;
+        unsigned long volume_size = strtoul(argv[3], &end, 10);
+        if(end == argv[3] || volume_size == 0) {
+            fprintf(stderr, "Invalid volume size: %s\n", argv[3]);
+            return 1;
+        }
+        char archive_name[256];
+        if(snprintf(archive_name, sizeof(archive_name), "%s.mpak", argv[2]) >= (int)sizeof(archive_name)) {
+            fprintf(stderr, "Folder path is too long: %s\n", argv[2]);
+            return 1;
+        }
+
+        size_t tag_size = argc == 5 ? strlen(argv[4]) : 0;
+        if(tag_size > sizeof(((package *)0)->id)) {
+            fprintf(stderr, "Tag is longer than 4 characters: %s\n", argv[4]);
+            return 1;
+        }
+
+        package pkg = load_package_folder(argv[2]);
+        if(argc == 5) {
+            memset(pkg.id, 0, sizeof(pkg.id));
+            memcpy(pkg.id, argv[4], tag_size);
+        }
+        uint32_t volume_count = save_package_volumes(archive_name, pkg, volume_size);
+        free_package(pkg);
+        if(volume_count == 0) {
+            fprintf(stderr, "Failed to create volumes of %s\n", archive_name);
+            return 1;
+        }
+        printf("Package created: %s (%u volumes)\n", archive_name, volume_count);
+        return 0;
+    }
+
+    // Report the layout of an archive
+    if((argc == 3 || argc == 4) && strcmp(argv[1], "analyze") == 0) {
+        bool json = argc == 4 && strcmp(argv[3], "--json") == 0;
+        if(argc == 4 && !json) {
+            fprintf(stderr, "Unknown option: %s\n", argv[3]);
+            return 1;
+        }
+        m_analysis analysis;
+        if(!analyze_archive(argv[2], &analysis)) {
+            fprintf(stderr, "Failed to analyze %s\n", argv[2]);
+            return 1;
+        }
+        if(json) print_analysis_json(argv[2], &analysis);
+        else print_analysis(argv[2], &analysis);
+        return 0;
+    }
+
     if(argc != 2 && argc != 3) {
         printf("argc: %d\n", argc);
 
@@ -11,6 +193,11 @@ int main(int argc, char * argv[]) {
         fprintf(stderr, "      \t%s <folder_path> <tag>\n", argv[0]);
         fprintf(stderr, "      \t%s <archive_file>\n", argv[0]);
         fprintf(stderr, "      \t%s <archive_file> -d  (Dumps the archive structure)\n", argv[0]);
+        fprintf(stderr, "      \t%s analyze <archive_file> [--json]  (Reports fan-out, sizes, duplicates, alignment and lookup cost)\n", argv[0]);
+        fprintf(stderr, "      \t%s diff <old_archive> <new_archive> <patch_file>\n", argv[0]);
+        fprintf(stderr, "      \t%s patch <old_archive> <patch_file> <new_archive>\n", argv[0]);
+        fprintf(stderr, "      \t%s --from-tar <tar_file|-> <archive_file> [tag]  (Imports a tar stream, - for stdin)\n", argv[0]);
+        fprintf(stderr, "      \t%s volumes <folder_path> <volume_size> [tag]  (Packs into <folder_path>.000.mpak, ...)\n", argv[0]);
         return 1;
     }
 
@@ -19,18 +206,24 @@ int main(int argc, char * argv[]) {
     if(stat(argv[1], &st) == 0) {
         if(S_ISDIR(st.st_mode)) {
             // It's a folder, create a package from it
-            package pkg = load_package_folder(argv[1]);
+            char archive_name[256], cache_name[256];
+            snprintf(archive_name, sizeof(archive_name), "%s.mpak", argv[1]);
+            snprintf(cache_name, sizeof(cache_name), "%s.mpak.cache", argv[1]);
+
+            // Unchanged files are copied from the previous archive
+            m_build_cache cache = load_build_cache(cache_name, archive_name);
+            package pkg = load_package_folder_cached(argv[1], &cache);
 
             // If a tag is provided, set it as the package ID
             if(argc == 3)
                 strncpy(pkg.id, argv[2], 4);
 
             // Save the package to a file
-            char archive_name[256];
-            snprintf(archive_name, sizeof(archive_name), "%s.mpak", argv[1]);
-            save_package_to_archive(archive_name, pkg);
-            printf("Package created: %s\n", archive_name);
+            save_package_to_archive_cached(archive_name, pkg, &cache);
+            save_build_cache(cache_name, archive_name, &cache);
+            printf("Package created: %s (%lu files reused, %lu loaded, %lu hashed)\n", archive_name, cache.reused, cache.loaded, cache.hashed);
 
+            free_build_cache(cache);
             free_package(pkg); // Free the package resources
         } 
         else if(S_ISREG(st.st_mode)) {
@@ -43,6 +236,7 @@ int main(int argc, char * argv[]) {
             else if(argc == 3 && strcmp(argv[2], "-d") == 0) {
                 // Dump the archive structure
                 printf("Package ID: %.4s\n", pkg.id);
+                printf("Package Format Version: %u\n", pkg.version);
                 printf("Package Structure Size: %lu bytes\n", pkg.struct_size);
                 printf("Package Data Size: %lu bytes\n", pkg.data_size);
                 printf("Root Name: %s\n", pkg.root.name);